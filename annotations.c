@@ -0,0 +1,207 @@
+/*
+ * dexinfo - a very rudimentary dex file parser
+ *
+ * Copyright (C) 2014 Keith Makan (@k3170Makan)
+ * Copyright (C) 2012-2013 Pau Oliva Fora (@pof)
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * annotations_directory_item decoding. Nothing is copied out of the image:
+ * sets and ref lists are indexed in place and an annotation_item is only
+ * decoded up to its type when a caller looks for one type in particular.
+ */
+
+#include "dexinfo.h"
+
+const annotations_directory_item *
+dex_annotations_dir(const dex_image *dex, const class_def_struct *class_def)
+{
+	const annotations_directory_item *dir;
+	u4 off = *class_def->annotations_off;
+	u8 members;
+
+	if (off == 0 || !dex_in_image(dex, off, sizeof(*dir)))
+		return NULL;
+
+	dir = (const annotations_directory_item *)(dex->base + off);
+	members = (u8)*dir->fields_size + *dir->annotated_methods_size + *dir->annotated_parameters_size;
+	if (!dex_in_image(dex, off + sizeof(*dir), members * sizeof(member_annotation_struct)))
+		return NULL;
+
+	return dir;
+}
+
+/* the field, method and parameter lists follow each other after the directory header */
+const member_annotation_struct *
+dex_annotations_members(const dex_image *dex, const annotations_directory_item *dir, int kind)
+{
+	const member_annotation_struct *list = (const member_annotation_struct *)(dir + 1);
+
+	switch (kind) {
+	case DEX_ANNOTATION_FIELD:
+		return list;
+	case DEX_ANNOTATION_METHOD:
+		return list + *dir->fields_size;
+	case DEX_ANNOTATION_PARAMETER:
+		return list + *dir->fields_size + *dir->annotated_methods_size;
+	}
+
+	return NULL;
+}
+
+/* annotation_set_item and annotation_set_ref_list are both a u4 size followed by u4 offsets */
+static u4 offset_list_size(const dex_image *dex, u4 off)
+{
+	u4 size;
+
+	if (off == 0 || !dex_in_image(dex, off, sizeof(u4)))
+		return 0;
+
+	size = *(u4 *)(dex->base + off);
+	if (!dex_in_image(dex, off + sizeof(u4), (u8)size * sizeof(u4)))
+		return 0;
+
+	return size;
+}
+
+static u4 offset_list_at(const dex_image *dex, u4 off, u4 i)
+{
+	return ((u4 *)(dex->base + off + sizeof(u4)))[i];
+}
+
+u4 dex_annotation_set_size(const dex_image *dex, u4 set_off)
+{
+	return offset_list_size(dex, set_off);
+}
+
+u4 dex_annotation_ref_list_size(const dex_image *dex, u4 list_off)
+{
+	return offset_list_size(dex, list_off);
+}
+
+/* annotation set offset for parameter i, 0 when the parameter has none */
+u4 dex_annotation_ref_list_at(const dex_image *dex, u4 list_off, u4 i)
+{
+	return offset_list_at(dex, list_off, i);
+}
+
+/* callers must have checked i against dex_annotation_set_size() */
+int dex_annotation_at(const dex_image *dex, u4 set_off, u4 i, dex_annotation *annotation)
+{
+	u4 off = offset_list_at(dex, set_off, i);
+	u1 *ptr;
+
+	if (off == 0 || !dex_in_image(dex, off, 2))
+		return -1;
+
+	ptr = dex->base + off;
+	annotation->visibility = *ptr++;
+	annotation->type_idx = dex_uleb128(dex, &ptr);
+	annotation->size = dex_uleb128(dex, &ptr);
+	annotation->elements = ptr;
+
+	return 0;
+}
+
+/*
+ * Report the annotations of one set. With a type_idx other than NO_INDEX
+ * every entry is only decoded as far as its type.
+ */
+static int walk_set(const dex_image *dex, u4 set_off, u4 type_idx,
+		dex_annotation_hit *hit, dex_annotation_cb cb, void *ctx)
+{
+	u4 i, n, off;
+	u1 *ptr;
+	int hits = 0;
+
+	n = dex_annotation_set_size(dex, set_off);
+	for (i = 0; i < n; i++) {
+		if (dex->budget && dex_budget_spend(dex, 0))
+			break;
+		off = offset_list_at(dex, set_off, i);
+		if (off == 0 || !dex_in_image(dex, off, 2))
+			continue;
+
+		ptr = dex->base + off + 1;
+		if (type_idx != NO_INDEX && dex_uleb128(dex, &ptr) != type_idx)
+			continue;
+
+		if (dex_annotation_at(dex, set_off, i, &hit->annotation) < 0)
+			continue;
+
+		cb(dex, hit, ctx);
+		hits++;
+	}
+
+	return hits;
+}
+
+/*
+ * Walk the annotations of class class_def_idx: the class itself, then its
+ * fields, methods and method parameters. Returns the number of annotations
+ * reported, only those of type type_idx unless that is NO_INDEX, up to
+ * where the budget of dex stopped the walk.
+ */
+int dex_annotations_walk(const dex_image *dex, u4 class_def_idx, u4 type_idx,
+		dex_annotation_cb cb, void *ctx)
+{
+	const annotations_directory_item *dir;
+	const member_annotation_struct *list;
+	dex_annotation_hit hit;
+	u4 i, p, n;
+	int hits = 0;
+
+	if (class_def_idx >= *dex->header->class_defs_size)
+		return 0;
+
+	dir = dex_annotations_dir(dex, &dex->class_defs[class_def_idx]);
+	if (dir == NULL)
+		return 0;
+
+	memset(&hit, 0, sizeof(hit));
+	hit.class_def_idx = class_def_idx;
+
+	hit.kind = DEX_ANNOTATION_CLASS;
+	hits += walk_set(dex, *dir->class_annotations_off, type_idx, &hit, cb, ctx);
+
+	hit.kind = DEX_ANNOTATION_FIELD;
+	list = dex_annotations_members(dex, dir, hit.kind);
+	for (i = 0; i < *dir->fields_size; i++) {
+		hit.member_idx = *list[i].idx;
+		hits += walk_set(dex, *list[i].annotations_off, type_idx, &hit, cb, ctx);
+	}
+
+	hit.kind = DEX_ANNOTATION_METHOD;
+	list = dex_annotations_members(dex, dir, hit.kind);
+	for (i = 0; i < *dir->annotated_methods_size; i++) {
+		hit.member_idx = *list[i].idx;
+		hits += walk_set(dex, *list[i].annotations_off, type_idx, &hit, cb, ctx);
+	}
+
+	hit.kind = DEX_ANNOTATION_PARAMETER;
+	list = dex_annotations_members(dex, dir, hit.kind);
+	for (i = 0; i < *dir->annotated_parameters_size; i++) {
+		hit.member_idx = *list[i].idx;
+		n = dex_annotation_ref_list_size(dex, *list[i].annotations_off);
+		for (p = 0; p < n && !(dex->budget && dex->budget->status); p++) {
+			hit.param = p;
+			hits += walk_set(dex, dex_annotation_ref_list_at(dex, *list[i].annotations_off, p),
+					type_idx, &hit, cb, ctx);
+		}
+	}
+
+	return hits;
+}
@@ -0,0 +1,157 @@
+/*
+ * dexinfo - a very rudimentary dex file parser
+ *
+ * Copyright (C) 2014 Keith Makan (@k3170Makan)
+ * Copyright (C) 2012-2013 Pau Oliva Fora (@pof)
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Per-parse arena. Everything a parse allocates is bumped out of a few
+ * large blocks and given back at once by dex_arena_release(), so nothing
+ * is freed piecemeal and the memory of a parse can be capped.
+ */
+
+#include "dexinfo.h"
+
+#define ARENA_ALIGN		16
+#define ARENA_FIRST_BLOCK	(64 * 1024)
+#define ARENA_MAX_BLOCK		(1024 * 1024)
+
+struct dex_arena_block {
+	struct dex_arena_block *next;
+	size_t size;		/* usable bytes in data */
+	size_t used;
+	u1 data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+void dex_arena_init(dex_arena *arena, size_t limit)
+{
+	memset(arena, 0, sizeof(*arena));
+	arena->limit = limit;
+	arena->next_block = ARENA_FIRST_BLOCK;
+}
+
+static dex_arena_block * new_block(dex_arena *arena, size_t size)
+{
+	dex_arena_block *block;
+	size_t want = size > arena->next_block ? size : arena->next_block;
+
+	/* near the cap, settle for a block that only fits this request */
+	if (arena->limit && arena->allocated + sizeof(*block) + want > arena->limit)
+		want = size;
+	if (arena->limit && arena->allocated + sizeof(*block) + want > arena->limit) {
+		arena->exceeded = 1;
+		return NULL;
+	}
+
+	block = malloc(sizeof(*block) + want);
+	if (block == NULL)
+		return NULL;
+
+	block->next = arena->head;
+	block->size = want;
+	block->used = 0;
+	arena->head = block;
+	arena->allocated += sizeof(*block) + want;
+
+	if (arena->next_block < ARENA_MAX_BLOCK)
+		arena->next_block *= 2;
+
+	return block;
+}
+
+/* NULL when out of memory or over the limit, see dex_arena.exceeded */
+void * dex_arena_alloc(dex_arena *arena, size_t size)
+{
+	dex_arena_block *block = arena->head;
+	size_t used;
+
+	if (size == 0)
+		size = 1;
+	if (size > SIZE_MAX - ARENA_ALIGN)
+		return NULL;
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+	if (block == NULL || block->size - block->used < size) {
+		block = new_block(arena, size);
+		if (block == NULL)
+			return NULL;
+	}
+
+	used = block->used;
+	block->used += size;
+	arena->last = block->data + used;
+
+	return arena->last;
+}
+
+void * dex_arena_calloc(dex_arena *arena, size_t n, size_t size)
+{
+	void *ptr;
+
+	if (size && n > SIZE_MAX / size)
+		return NULL;
+
+	ptr = dex_arena_alloc(arena, n * size);
+	if (ptr)
+		memset(ptr, 0, n * size);
+
+	return ptr;
+}
+
+/*
+ * Grow an allocation from old_size to size bytes. The most recent
+ * allocation grows in place when its block has room, anything else is
+ * copied and the old copy stays in the arena until it is released.
+ */
+void * dex_arena_grow(dex_arena *arena, void *ptr, size_t old_size, size_t size)
+{
+	dex_arena_block *block = arena->head;
+	size_t start, end;
+	void *copy;
+
+	if (ptr == NULL)
+		return dex_arena_alloc(arena, size);
+
+	if (ptr == arena->last && block) {
+		start = (u1 *)ptr - block->data;
+		if (size <= block->size - start) {
+			end = (start + size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+			if (end > block->used)
+				block->used = end < block->size ? end : block->size;
+			return ptr;
+		}
+	}
+
+	copy = dex_arena_alloc(arena, size);
+	if (copy)
+		memcpy(copy, ptr, old_size < size ? old_size : size);
+
+	return copy;
+}
+
+/* give back every block, the arena can be used again afterwards */
+void dex_arena_release(dex_arena *arena)
+{
+	dex_arena_block *block, *next;
+
+	for (block = arena->head; block; block = next) {
+		next = block->next;
+		free(block);
+	}
+
+	dex_arena_init(arena, arena->limit);
+}
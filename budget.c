@@ -0,0 +1,98 @@
+/*
+ * dexinfo - a very rudimentary dex file parser
+ *
+ * Copyright (C) 2014 Keith Makan (@k3170Makan)
+ * Copyright (C) 2012-2013 Pau Oliva Fora (@pof)
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Budget of a parse: wall time, decoded items, the memory cap of its arena
+ * and a cancel flag another thread or a signal handler may set. Nothing
+ * interrupts a parse; the walks ask dex_budget_spend() at every class and
+ * every member whether to go on and, once it says no, return what they
+ * have, so a hostile file whose ULEB128 counts ask for billions of entries
+ * ends as a partial result instead of a stuck process.
+ */
+
+#include <time.h>
+
+#include "dexinfo.h"
+
+/* checks between two looks at the clock */
+#define CLOCK_STRIDE	16
+
+static u8 now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u8)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* time_limit in milliseconds, time_limit and max_items 0 for none, cancel may be NULL */
+void dex_budget_init(dex_budget *budget, u4 time_limit, u8 max_items, volatile sig_atomic_t *cancel)
+{
+	memset(budget, 0, sizeof(*budget));
+	budget->deadline = time_limit ? now_ms() + time_limit : 0;
+	budget->max_items = max_items;
+	budget->cancel = cancel;
+}
+
+/*
+ * Count items decoded by a walk of dex and tell whether it may go on: 0
+ * while it may, the DEX_BUDGET_* reason to stop otherwise, for this call
+ * and every later one. Loops over what is not an item pass 0 items, which
+ * still checks the time, the cancel flag and the memory cap.
+ */
+int dex_budget_spend(const dex_image *dex, u4 items)
+{
+	dex_budget *budget = dex->budget;
+
+	if (budget == NULL || budget->status)
+		return budget ? budget->status : 0;
+
+	budget->items += items;
+	budget->checks++;
+	if (budget->cancel && *budget->cancel)
+		budget->status = DEX_BUDGET_CANCELLED;
+	else if (budget->max_items && budget->items > budget->max_items)
+		budget->status = DEX_BUDGET_ITEMS;
+	else if (dex->arena->exceeded)
+		budget->status = DEX_BUDGET_MEMORY;
+	else if (budget->deadline && budget->checks >= budget->next_clock) {
+		budget->next_clock = budget->checks + CLOCK_STRIDE;
+		if (now_ms() >= budget->deadline)
+			budget->status = DEX_BUDGET_TIME;
+	}
+
+	return budget->status;
+}
+
+const char * dex_budget_reason(int status)
+{
+	switch (status) {
+	case DEX_BUDGET_CANCELLED:
+		return "cancelled";
+	case DEX_BUDGET_TIME:
+		return "time limit exceeded";
+	case DEX_BUDGET_ITEMS:
+		return "item limit exceeded";
+	case DEX_BUDGET_MEMORY:
+		return "memory limit exceeded";
+	}
+
+	return "complete";
+}
@@ -0,0 +1,147 @@
+/*
+ * dexinfo - a very rudimentary dex file parser
+ *
+ * Copyright (C) 2014 Keith Makan (@k3170Makan)
+ * Copyright (C) 2012-2013 Pau Oliva Fora (@pof)
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Image cache of a server worker. Each entry keeps a mapped dex and the
+ * indexes built over it, so a request for a dex seen recently skips the
+ * mapping, the table checks and the hierarchy pass. Entries are found by
+ * the signature, checksum and size in the header, whatever path or
+ * descriptor the file came through, and the least recently used one is
+ * dropped when the cache is full.
+ */
+
+#ifndef PYDEXINFO
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "dexinfo.h"
+
+int dex_cache_init(dex_cache *cache, u4 size)
+{
+	memset(cache, 0, sizeof(*cache));
+
+	cache->entries = calloc(size ? size : 1, sizeof(dex_cache_entry));
+	if (cache->entries == NULL)
+		return -1;
+	cache->size = size ? size : 1;
+
+	return 0;
+}
+
+static void drop_entry(dex_cache_entry *entry)
+{
+	dex_unload(&entry->dex);
+	dex_arena_release(&entry->arena);
+	memset(entry, 0, sizeof(*entry));
+}
+
+static int read_header(char *dexfile, dex_header *header)
+{
+	int fd = open(dexfile, O_RDONLY);
+	ssize_t len;
+
+	if (fd < 0)
+		return -1;
+
+	len = pread(fd, header, sizeof(*header), 0);
+	close(fd);
+
+	return len == sizeof(*header) ? 0 : -1;
+}
+
+/* NULL when the file can't be loaded, the caller then loads it the usual way to report why */
+dex_cache_entry * dex_cache_get(dex_cache *cache, char *dexfile)
+{
+	dex_cache_entry *entry, *victim = NULL;
+	dex_header header;
+	u4 i;
+
+	if (read_header(dexfile, &header) < 0)
+		return NULL;
+
+	for (i = 0; i < cache->size; i++) {
+		entry = &cache->entries[i];
+		if (entry->last_used && *header.checksum == entry->checksum &&
+		    *header.file_size == entry->file_size &&
+		    memcmp(header.signature, entry->signature, sizeof(entry->signature)) == 0) {
+			entry->last_used = ++cache->clock;
+			return entry;
+		}
+		if (victim == NULL || entry->last_used < victim->last_used)
+			victim = entry;
+	}
+
+	if (victim->last_used)
+		drop_entry(victim);
+
+	dex_arena_init(&victim->arena, 0);
+	if (dex_load(&victim->dex, dexfile, 0, &victim->arena) < 0 ||
+	    strncmp(victim->dex.header->magic.dex, "dex", 3) != 0) {
+		drop_entry(victim);
+		return NULL;
+	}
+
+	/* keyed by what the mapped image says, in case the file changed since the header was read */
+	memcpy(victim->signature, victim->dex.header->signature, sizeof(victim->signature));
+	victim->checksum = *victim->dex.header->checksum;
+	victim->file_size = *victim->dex.header->file_size;
+	victim->last_used = ++cache->clock;
+
+	return victim;
+}
+
+/* the hierarchy index of the entry, built the first time it is asked for */
+dex_hierarchy * dex_cache_hierarchy(dex_cache_entry *entry)
+{
+	if (!entry->has_hierarchy) {
+		if (dex_hierarchy_build(&entry->dex, &entry->hierarchy) < 0)
+			return NULL;
+		entry->has_hierarchy = 1;
+	}
+
+	return &entry->hierarchy;
+}
+
+/* debug information already decoded by earlier requests is kept with the entry */
+dex_debug * dex_cache_debug(dex_cache_entry *entry)
+{
+	if (!entry->has_debug) {
+		dex_debug_init(&entry->dex, &entry->debug);
+		entry->has_debug = 1;
+	}
+
+	return &entry->debug;
+}
+
+void dex_cache_free(dex_cache *cache)
+{
+	u4 i;
+
+	for (i = 0; i < cache->size; i++) {
+		if (cache->entries[i].last_used)
+			drop_entry(&cache->entries[i]);
+	}
+
+	free(cache->entries);
+	memset(cache, 0, sizeof(*cache));
+}
+
+#endif
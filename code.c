@@ -0,0 +1,377 @@
+/*
+ * dexinfo - a very rudimentary dex file parser
+ *
+ * Copyright (C) 2014 Keith Makan (@k3170Makan)
+ * Copyright (C) 2012-2013 Pau Oliva Fora (@pof)
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * code_item access: instruction widths and index operands from the opcode
+ * table, and content hashes of code that do not depend on how the string,
+ * type, field and method tables of a particular dex are numbered.
+ */
+
+#include "dexinfo.h"
+
+/* format of every opcode, unused opcodes decode as 10x */
+static const u1 insn_formats[256] = {
+	/* 0x00 */ FMT_10x, FMT_12x, FMT_22x, FMT_32x, FMT_12x, FMT_22x, FMT_32x, FMT_12x,
+	/* 0x08 */ FMT_22x, FMT_32x, FMT_11x, FMT_11x, FMT_11x, FMT_11x, FMT_10x, FMT_11x,
+	/* 0x10 */ FMT_11x, FMT_11x, FMT_11n, FMT_21s, FMT_31i, FMT_21h, FMT_21s, FMT_31i,
+	/* 0x18 */ FMT_51l, FMT_21h, FMT_21c, FMT_31c, FMT_21c, FMT_11x, FMT_11x, FMT_21c,
+	/* 0x20 */ FMT_22c, FMT_12x, FMT_21c, FMT_22c, FMT_35c, FMT_3rc, FMT_31t, FMT_11x,
+	/* 0x28 */ FMT_10t, FMT_20t, FMT_30t, FMT_31t, FMT_31t, FMT_23x, FMT_23x, FMT_23x,
+	/* 0x30 */ FMT_23x, FMT_23x, FMT_22t, FMT_22t, FMT_22t, FMT_22t, FMT_22t, FMT_22t,
+	/* 0x38 */ FMT_21t, FMT_21t, FMT_21t, FMT_21t, FMT_21t, FMT_21t, FMT_10x, FMT_10x,
+	/* 0x40 */ FMT_10x, FMT_10x, FMT_10x, FMT_10x, FMT_23x, FMT_23x, FMT_23x, FMT_23x,
+	/* 0x48 */ FMT_23x, FMT_23x, FMT_23x, FMT_23x, FMT_23x, FMT_23x, FMT_23x, FMT_23x,
+	/* 0x50 */ FMT_23x, FMT_23x, FMT_22c, FMT_22c, FMT_22c, FMT_22c, FMT_22c, FMT_22c,
+	/* 0x58 */ FMT_22c, FMT_22c, FMT_22c, FMT_22c, FMT_22c, FMT_22c, FMT_22c, FMT_22c,
+	/* 0x60 */ FMT_21c, FMT_21c, FMT_21c, FMT_21c, FMT_21c, FMT_21c, FMT_21c, FMT_21c,
+	/* 0x68 */ FMT_21c, FMT_21c, FMT_21c, FMT_21c, FMT_21c, FMT_21c, FMT_35c, FMT_35c,
+	/* 0x70 */ FMT_35c, FMT_35c, FMT_35c, FMT_10x, FMT_3rc, FMT_3rc, FMT_3rc, FMT_3rc,
+	/* 0x78 */ FMT_3rc, FMT_10x, FMT_10x, FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x,
+	/* 0x80 */ FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x,
+	/* 0x88 */ FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x,
+	/* 0x90 */ FMT_23x, FMT_23x, FMT_23x, FMT_23x, FMT_23x, FMT_23x, FMT_23x, FMT_23x,
+	/* 0x98 */ FMT_23x, FMT_23x, FMT_23x, FMT_23x, FMT_23x, FMT_23x, FMT_23x, FMT_23x,
+	/* 0xa0 */ FMT_23x, FMT_23x, FMT_23x, FMT_23x, FMT_23x, FMT_23x, FMT_23x, FMT_23x,
+	/* 0xa8 */ FMT_23x, FMT_23x, FMT_23x, FMT_23x, FMT_23x, FMT_23x, FMT_23x, FMT_23x,
+	/* 0xb0 */ FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x,
+	/* 0xb8 */ FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x,
+	/* 0xc0 */ FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x,
+	/* 0xc8 */ FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x, FMT_12x,
+	/* 0xd0 */ FMT_22s, FMT_22s, FMT_22s, FMT_22s, FMT_22s, FMT_22s, FMT_22s, FMT_22s,
+	/* 0xd8 */ FMT_22b, FMT_22b, FMT_22b, FMT_22b, FMT_22b, FMT_22b, FMT_22b, FMT_22b,
+	/* 0xe0 */ FMT_22b, FMT_22b, FMT_22b, FMT_10x, FMT_10x, FMT_10x, FMT_10x, FMT_10x,
+	/* 0xe8 */ FMT_10x, FMT_10x, FMT_10x, FMT_10x, FMT_10x, FMT_10x, FMT_10x, FMT_10x,
+	/* 0xf0 */ FMT_10x, FMT_10x, FMT_10x, FMT_10x, FMT_10x, FMT_10x, FMT_10x, FMT_10x,
+	/* 0xf8 */ FMT_10x, FMT_10x, FMT_45cc, FMT_4rcc, FMT_35c, FMT_3rc, FMT_21c, FMT_21c,
+};
+
+/* code units per format, in FMT_* order */
+static const u1 format_widths[] = {
+	1, 1, 1, 1, 1, 2, 2, 2,
+	2, 2, 2, 2, 2, 2, 2, 2,
+	3, 3, 3, 3, 3, 3, 3, 4,
+	4, 5, 0
+};
+
+static int insn_index_kind(u1 opcode)
+{
+	switch (opcode) {
+	case 0x1a:			/* const-string */
+	case 0x1b:			/* const-string/jumbo */
+		return INDEX_STRING;
+	case 0x1c:			/* const-class */
+	case 0x1f:			/* check-cast */
+	case 0x20:			/* instance-of */
+	case 0x22:			/* new-instance */
+	case 0x23:			/* new-array */
+	case 0x24:			/* filled-new-array */
+	case 0x25:			/* filled-new-array/range */
+		return INDEX_TYPE;
+	case 0xfa:			/* invoke-polymorphic, the proto is in unit 3 */
+	case 0xfb:			/* invoke-polymorphic/range */
+		return INDEX_METHOD;
+	case 0xfc:			/* invoke-custom */
+	case 0xfd:			/* invoke-custom/range */
+		return INDEX_CALL_SITE;
+	case 0xfe:			/* const-method-handle */
+		return INDEX_METHOD_HANDLE;
+	case 0xff:			/* const-method-type */
+		return INDEX_PROTO;
+	}
+
+	if (opcode >= 0x52 && opcode <= 0x6d)	/* iget..sput-short */
+		return INDEX_FIELD;
+	if ((opcode >= 0x6e && opcode <= 0x72) || (opcode >= 0x74 && opcode <= 0x78))
+		return INDEX_METHOD;
+
+	return INDEX_NONE;
+}
+
+const code_item_struct * dex_code_item(const dex_image *dex, u4 off)
+{
+	const code_item_struct *code;
+
+	if (off == 0 || !dex_in_image(dex, off, sizeof(code_item_struct)))
+		return NULL;
+
+	code = (const code_item_struct *)(dex->base + off);
+	if (!dex_in_image(dex, off + sizeof(code_item_struct), (u8)*code->insns_size * sizeof(u2)))
+		return NULL;
+
+	return code;
+}
+
+/*
+ * Decode the instruction at code unit pc. Switch and array payloads come
+ * back as FMT_PAYLOAD with their full width. Returns -1 when the
+ * instruction runs past insns_size.
+ */
+int dex_insn_decode(const code_item_struct *code, u4 pc, dex_insn *insn)
+{
+	u4 left = *code->insns_size - pc;
+	const u2 *ptr = code->insns + pc;
+	u8 width;
+
+	if (pc >= *code->insns_size)
+		return -1;
+
+	insn->insn = ptr;
+	insn->opcode = ptr[0] & 0xff;
+	insn->format = insn_formats[insn->opcode];
+	insn->index_kind = INDEX_NONE;
+	insn->index = 0;
+	width = format_widths[insn->format];
+
+	/* nop with an ident in the high byte */
+	if (insn->opcode == 0x00 && ptr[0] != 0x0000 && left >= 4) {
+		insn->format = FMT_PAYLOAD;
+		switch (ptr[0]) {
+		case 0x0100:	/* packed-switch-payload: size, first_key, targets */
+			width = 4 + (u8)ptr[1] * 2;
+			break;
+		case 0x0200:	/* sparse-switch-payload: size, keys, targets */
+			width = 2 + (u8)ptr[1] * 4;
+			break;
+		case 0x0300:	/* fill-array-data-payload: element_width, size, data */
+			width = 4 + ((u8)ptr[1] * (ptr[2] | (u8)ptr[3] << 16) + 1) / 2;
+			break;
+		default:
+			insn->format = FMT_10x;
+			width = 1;
+		}
+	}
+
+	if (width > left)
+		return -1;
+	insn->width = (u4)width;
+
+	switch (insn->format) {
+	case FMT_21c:
+	case FMT_22c:
+	case FMT_35c:
+	case FMT_3rc:
+	case FMT_45cc:
+	case FMT_4rcc:
+		insn->index_kind = insn_index_kind(insn->opcode);
+		insn->index = ptr[1];
+		break;
+	case FMT_31c:
+		insn->index_kind = insn_index_kind(insn->opcode);
+		insn->index = ptr[1] | (u4)ptr[2] << 16;
+		break;
+	}
+
+	return 0;
+}
+
+int dex_hashes_init(const dex_image *dex, dex_hashes *hashes)
+{
+	u4 n = *dex->header->string_ids_size;
+
+	hashes->dex = dex;
+	hashes->strings = dex_arena_calloc(dex->arena, n ? n : 1, sizeof(u8));
+
+	return hashes->strings ? 0 : -1;
+}
+
+/* out of range indexes all hash alike */
+#define BAD_INDEX_HASH 0x6261646964786521ULL
+
+u8 dex_string_hash(dex_hashes *hashes, u4 string_idx)
+{
+	const char *str;
+	u8 h;
+
+	if (string_idx >= *hashes->dex->header->string_ids_size)
+		return BAD_INDEX_HASH;
+
+	h = hashes->strings[string_idx];
+	if (h == 0) {
+		str = dex_string(hashes->dex, string_idx);
+		h = str ? dex_hash(str, strlen(str), 0) : BAD_INDEX_HASH;
+		if (h == 0)
+			h = 1;
+		hashes->strings[string_idx] = h;
+	}
+
+	return h;
+}
+
+u8 dex_type_hash(dex_hashes *hashes, u4 type_idx)
+{
+	if (type_idx >= *hashes->dex->header->type_ids_size)
+		return BAD_INDEX_HASH;
+
+	return dex_string_hash(hashes, *hashes->dex->type_ids[type_idx].descriptor_idx);
+}
+
+u8 dex_proto_hash(dex_hashes *hashes, u4 proto_idx)
+{
+	const proto_id_struct *proto;
+	const u2 *params;
+	u4 i, n;
+	u8 h;
+
+	if (proto_idx >= *hashes->dex->header->proto_ids_size)
+		return BAD_INDEX_HASH;
+
+	proto = &hashes->dex->proto_ids[proto_idx];
+	h = dex_hash_mix(INDEX_PROTO, dex_type_hash(hashes, *proto->return_type_idx));
+	params = dex_type_list(hashes->dex, *proto->parameters_off, &n);
+	for (i = 0; i < n; i++)
+		h = dex_hash_mix(h, dex_type_hash(hashes, params[i]));
+
+	return h;
+}
+
+u8 dex_field_hash(dex_hashes *hashes, u4 field_idx)
+{
+	const field_id_struct *field;
+	u8 h;
+
+	if (field_idx >= *hashes->dex->header->field_ids_size)
+		return BAD_INDEX_HASH;
+
+	field = &hashes->dex->field_ids[field_idx];
+	h = dex_hash_mix(INDEX_FIELD, dex_type_hash(hashes, *field->class_idx));
+	h = dex_hash_mix(h, dex_string_hash(hashes, *field->name_idx));
+	return dex_hash_mix(h, dex_type_hash(hashes, *field->type_idx));
+}
+
+u8 dex_method_hash(dex_hashes *hashes, u4 method_idx)
+{
+	const method_id_struct *method;
+	u8 h;
+
+	if (method_idx >= *hashes->dex->header->method_ids_size)
+		return BAD_INDEX_HASH;
+
+	method = &hashes->dex->method_ids[method_idx];
+	h = dex_hash_mix(INDEX_METHOD, dex_type_hash(hashes, *method->class_idx));
+	h = dex_hash_mix(h, dex_string_hash(hashes, *method->name_idx));
+	return dex_hash_mix(h, dex_proto_hash(hashes, *method->proto_idx));
+}
+
+u8 dex_index_hash(dex_hashes *hashes, int index_kind, u4 index)
+{
+	switch (index_kind) {
+	case INDEX_STRING:
+		return dex_string_hash(hashes, index);
+	case INDEX_TYPE:
+		return dex_type_hash(hashes, index);
+	case INDEX_FIELD:
+		return dex_field_hash(hashes, index);
+	case INDEX_METHOD:
+		return dex_method_hash(hashes, index);
+	case INDEX_PROTO:
+		return dex_proto_hash(hashes, index);
+	}
+
+	/* call sites and method handles are compared by index */
+	return dex_hash_mix(index_kind, index);
+}
+
+/*
+ * Mix the try_items of code into h as they are, and the handlers with what
+ * cb makes of each catch type. The diff hashes catch types by content,
+ * fingerprints by kind unless they belong to the platform.
+ */
+u8 dex_tries_hash(const dex_image *dex, const code_item_struct *code, u8 h, dex_catch_hash_cb cb, void *ctx)
+{
+	u1 *ptr, *end;
+	u4 tries_off, handlers, i, j, count;
+	s4 n;
+
+	/* try_items are 4 byte aligned after insns */
+	tries_off = ((u1 *)(code->insns + *code->insns_size) - dex->base + 3) & ~3u;
+	if (!dex_in_image(dex, tries_off, (u8)*code->tries_size * 8))
+		return dex_hash_mix(h, BAD_INDEX_HASH);
+
+	ptr = dex->base + tries_off;
+	h = dex_hash(ptr, (size_t)*code->tries_size * 8, h);
+
+	ptr += (size_t)*code->tries_size * 8;
+	end = dex->base + dex->size;
+	handlers = dex_uleb128(dex, &ptr);
+	for (i = 0; i < handlers && ptr < end; i++) {
+		n = dex_sleb128(dex, &ptr);
+		h = dex_hash_mix(h, (u8)(s8)n);
+		/* the magnitude unsigned, -INT_MIN does not fit an s4 */
+		count = n < 0 ? 0u - (u4)n : (u4)n;
+		for (j = 0; j < count && ptr < end; j++) {
+			h = dex_hash_mix(h, cb(ctx, dex_uleb128(dex, &ptr)));
+			h = dex_hash_mix(h, dex_uleb128(dex, &ptr));
+		}
+		if (n <= 0)
+			h = dex_hash_mix(h, dex_uleb128(dex, &ptr));
+	}
+
+	return h;
+}
+
+static u8 catch_type_hash(void *ctx, u4 type_idx)
+{
+	return dex_type_hash(ctx, type_idx);
+}
+
+/*
+ * Hash of a code_item in which every string, type, field, method and proto
+ * operand stands for its content instead of its index. Two methods with
+ * the same code hash alike in any dex, however the tables are numbered.
+ */
+u8 dex_code_hash(dex_hashes *hashes, const code_item_struct *code)
+{
+	dex_insn insn;
+	u2 units[5];
+	u4 pc = 0;
+	u8 h;
+
+	h = dex_hash_mix(*code->registers_size, (u8)*code->ins_size << 16 | (u8)*code->outs_size << 32);
+
+	while (pc < *code->insns_size) {
+		if (dex_insn_decode(code, pc, &insn) < 0) {
+			/* truncated, take the rest as it is */
+			h = dex_hash(code->insns + pc, (*code->insns_size - pc) * sizeof(u2), h);
+			break;
+		}
+
+		if (insn.index_kind == INDEX_NONE) {
+			h = dex_hash(insn.insn, insn.width * sizeof(u2), h);
+		} else {
+			memcpy(units, insn.insn, insn.width * sizeof(u2));
+			units[1] = 0;
+			if (insn.format == FMT_31c)
+				units[2] = 0;
+			if (insn.format == FMT_45cc || insn.format == FMT_4rcc)
+				units[3] = 0;
+			h = dex_hash(units, insn.width * sizeof(u2), h);
+			h = dex_hash_mix(h, dex_index_hash(hashes, insn.index_kind, insn.index));
+			if (insn.format == FMT_45cc || insn.format == FMT_4rcc)
+				h = dex_hash_mix(h, dex_proto_hash(hashes, insn.insn[3]));
+		}
+
+		pc += insn.width;
+	}
+
+	if (*code->tries_size)
+		h = dex_tries_hash(hashes->dex, code, h, catch_type_hash, hashes);
+
+	return h;
+}
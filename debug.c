@@ -0,0 +1,311 @@
+/*
+ * dexinfo - a very rudimentary dex file parser
+ *
+ * Copyright (C) 2014 Keith Makan (@k3170Makan)
+ * Copyright (C) 2012-2013 Pau Oliva Fora (@pof)
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * debug_info_item decoder. Nothing is decoded until the line table of a
+ * method is asked for; the state machine then runs over that method's
+ * debug_info_item only and the result, positions and locals in two exact
+ * sized arrays, is kept per method_idx for the next time.
+ */
+
+#include "dexinfo.h"
+
+#define DBG_END_SEQUENCE	0x00
+#define DBG_ADVANCE_PC		0x01
+#define DBG_ADVANCE_LINE	0x02
+#define DBG_START_LOCAL		0x03
+#define DBG_START_LOCAL_EXTENDED 0x04
+#define DBG_END_LOCAL		0x05
+#define DBG_RESTART_LOCAL	0x06
+#define DBG_SET_PROLOGUE_END	0x07
+#define DBG_SET_EPILOGUE_BEGIN	0x08
+#define DBG_SET_FILE		0x09
+#define DBG_FIRST_SPECIAL	0x0a
+#define DBG_LINE_BASE		(-4)
+#define DBG_LINE_RANGE		15
+
+#define ACC_STATIC		0x0008
+
+/* cached for methods without debug information, so they are not looked at twice */
+static dex_debug_info no_debug_info;
+
+void dex_debug_init(const dex_image *dex, dex_debug *debug)
+{
+	memset(debug, 0, sizeof(*debug));
+	debug->dex = dex;
+}
+
+/* scratch space of the decoder, reused from one method to the next */
+static int reserve(dex_debug *debug, void **array, u4 *alloc, u4 used, size_t size)
+{
+	void *grown;
+	u4 n;
+
+	if (used < *alloc)
+		return 0;
+
+	n = *alloc ? *alloc * 2 : 64;
+	grown = dex_arena_grow(debug->dex->arena, *array, (size_t)*alloc * size, (size_t)n * size);
+	if (grown == NULL)
+		return -1;
+
+	*array = grown;
+	*alloc = n;
+	return 0;
+}
+
+static int add_position(dex_debug *debug, u4 address, u4 line)
+{
+	if (reserve(debug, (void **)&debug->positions, &debug->positions_alloc, debug->positions_size,
+			sizeof(dex_debug_position)) < 0)
+		return -1;
+
+	debug->positions[debug->positions_size].address = address;
+	debug->positions[debug->positions_size].line = line;
+	debug->positions_size++;
+	return 0;
+}
+
+static void end_local(dex_debug *debug, u4 reg, u4 address)
+{
+	if (debug->live[reg] != NO_INDEX) {
+		debug->locals[debug->live[reg]].end = address;
+		debug->live[reg] = NO_INDEX;
+	}
+}
+
+/* a new local in reg, ending the one that was live there */
+static int start_local(dex_debug *debug, u4 reg, u4 address, u4 name_idx, u4 type_idx, u4 signature_idx, u2 flags)
+{
+	dex_debug_local *local;
+
+	end_local(debug, reg, address);
+
+	if (reserve(debug, (void **)&debug->locals, &debug->locals_alloc, debug->locals_size,
+			sizeof(dex_debug_local)) < 0)
+		return -1;
+
+	local = &debug->locals[debug->locals_size];
+	local->start = address;
+	local->end = NO_INDEX;
+	local->name_idx = name_idx;
+	local->type_idx = type_idx;
+	local->signature_idx = signature_idx;
+	local->reg = reg;
+	local->flags = flags;
+
+	debug->live[reg] = debug->last[reg] = debug->locals_size++;
+	return 0;
+}
+
+static int is_wide(const dex_image *dex, u4 type_idx)
+{
+	const char *desc = dex_type_desc(dex, type_idx);
+
+	return desc && (desc[0] == 'J' || desc[0] == 'D');
+}
+
+/* run the state machine of one debug_info_item into the scratch arrays, 1 when the budget stopped it */
+static int decode(dex_debug *debug, const method_id_struct *method_id, u4 access_flags,
+		const code_item_struct *code, u4 *file_idx)
+{
+	const dex_image *dex = debug->dex;
+	const u2 *params = NULL;
+	u1 *ptr = dex->base + *code->debug_info_off;
+	u1 *end = dex->base + dex->size;
+	u4 regs = *code->registers_size, reg, i, n, nparams = 0;
+	u4 address = 0, line, name_idx, type_idx, signature_idx;
+	u1 op;
+
+	debug->positions_size = 0;
+	debug->locals_size = 0;
+	if (regs > debug->regs_alloc) {
+		debug->live = dex_arena_alloc(dex->arena, (size_t)regs * 2 * sizeof(u4));
+		if (debug->live == NULL)
+			return -1;
+		debug->last = debug->live + regs;
+		debug->regs_alloc = regs;
+	}
+	for (reg = 0; reg < regs; reg++)
+		debug->live[reg] = debug->last[reg] = NO_INDEX;
+
+	line = dex_uleb128(dex, &ptr);
+	n = dex_uleb128(dex, &ptr);
+
+	if (*method_id->proto_idx < *dex->header->proto_ids_size)
+		params = dex_type_list(dex, *dex->proto_ids[*method_id->proto_idx].parameters_off, &nparams);
+
+	/* the arguments are in the last ins_size registers, this first */
+	reg = regs - (*code->ins_size < regs ? *code->ins_size : regs);
+	if (!(access_flags & ACC_STATIC) && reg < regs) {
+		if (start_local(debug, reg, 0, NO_INDEX, *method_id->class_idx, NO_INDEX, DEX_DEBUG_THIS) < 0)
+			return -1;
+		reg++;
+	}
+	for (i = 0; i < n && ptr < end; i++) {
+		name_idx = dex_uleb128(dex, &ptr) - 1;
+		if (i >= nparams)
+			continue;
+		if (name_idx != NO_INDEX && reg < regs &&
+		    start_local(debug, reg, 0, name_idx, params[i], NO_INDEX, DEX_DEBUG_PARAMETER) < 0)
+			return -1;
+		reg += is_wide(dex, params[i]) ? 2 : 1;
+	}
+
+	while (ptr < end) {
+		/* a stream without DBG_END_SEQUENCE runs to the end of the file */
+		if (dex->budget && dex_budget_spend(dex, 0))
+			return 1;
+		op = *ptr++;
+		switch (op) {
+		case DBG_END_SEQUENCE:
+			ptr = end;
+			break;
+		case DBG_ADVANCE_PC:
+			address += dex_uleb128(dex, &ptr);
+			break;
+		case DBG_ADVANCE_LINE:
+			line += dex_sleb128(dex, &ptr);
+			break;
+		case DBG_START_LOCAL:
+		case DBG_START_LOCAL_EXTENDED:
+			reg = dex_uleb128(dex, &ptr);
+			name_idx = dex_uleb128(dex, &ptr) - 1;
+			type_idx = dex_uleb128(dex, &ptr) - 1;
+			signature_idx = op == DBG_START_LOCAL_EXTENDED ? dex_uleb128(dex, &ptr) - 1 : NO_INDEX;
+			if (reg < regs && start_local(debug, reg, address, name_idx, type_idx, signature_idx, 0) < 0)
+				return -1;
+			break;
+		case DBG_END_LOCAL:
+			reg = dex_uleb128(dex, &ptr);
+			if (reg < regs)
+				end_local(debug, reg, address);
+			break;
+		case DBG_RESTART_LOCAL:
+			reg = dex_uleb128(dex, &ptr);
+			if (reg < regs && debug->live[reg] == NO_INDEX && debug->last[reg] != NO_INDEX) {
+				i = debug->last[reg];
+				if (start_local(debug, reg, address, debug->locals[i].name_idx, debug->locals[i].type_idx,
+						debug->locals[i].signature_idx, debug->locals[i].flags) < 0)
+					return -1;
+			}
+			break;
+		case DBG_SET_PROLOGUE_END:
+		case DBG_SET_EPILOGUE_BEGIN:
+			break;
+		case DBG_SET_FILE:
+			*file_idx = dex_uleb128(dex, &ptr) - 1;
+			break;
+		default:
+			op -= DBG_FIRST_SPECIAL;
+			address += op / DBG_LINE_RANGE;
+			line += DBG_LINE_BASE + op % DBG_LINE_RANGE;
+			if (add_position(debug, address, line) < 0)
+				return -1;
+		}
+	}
+
+	/* what is still live lasts to the end of the code */
+	for (reg = 0; reg < regs; reg++)
+		end_local(debug, reg, *code->insns_size);
+
+	return 0;
+}
+
+/*
+ * Line table and locals of a method, decoded the first time they are asked
+ * for. NULL when the method has no debug information, when the budget of
+ * the dex stopped the decoding, or when out of memory, which also sets
+ * dex_debug.failed.
+ */
+const dex_debug_info * dex_debug_get(dex_debug *debug, u4 method_idx, u4 access_flags, u4 code_off)
+{
+	const dex_image *dex = debug->dex;
+	const code_item_struct *code;
+	dex_debug_info *info;
+	u4 file_idx = NO_INDEX;
+	int ret;
+
+	if (method_idx >= *dex->header->method_ids_size)
+		return NULL;
+
+	if (debug->methods == NULL) {
+		debug->methods = dex_arena_calloc(dex->arena, *dex->header->method_ids_size, sizeof(dex_debug_info *));
+		if (debug->methods == NULL) {
+			debug->failed = 1;
+			return NULL;
+		}
+	}
+
+	info = debug->methods[method_idx];
+	if (info)
+		return info == &no_debug_info ? NULL : info;
+
+	code = code_off ? dex_code_item(dex, code_off) : NULL;
+	if (code == NULL || *code->debug_info_off == 0 || !dex_in_image(dex, *code->debug_info_off, 1)) {
+		debug->methods[method_idx] = &no_debug_info;
+		return NULL;
+	}
+
+	ret = decode(debug, &dex->method_ids[method_idx], access_flags, code, &file_idx);
+	if (ret < 0) {
+		debug->failed = 1;
+		return NULL;
+	}
+	/* stopped by the budget: nothing is kept, a later parse decodes it again */
+	if (ret > 0)
+		return NULL;
+
+	/* the compact copy, the scratch arrays stay with the decoder */
+	info = dex_arena_alloc(dex->arena, sizeof(*info) +
+		debug->positions_size * sizeof(dex_debug_position) + debug->locals_size * sizeof(dex_debug_local));
+	if (info == NULL) {
+		debug->failed = 1;
+		return NULL;
+	}
+
+	info->file_idx = file_idx;
+	info->positions_size = debug->positions_size;
+	info->locals_size = debug->locals_size;
+	info->locals = (dex_debug_local *)(info + 1);
+	info->positions = (dex_debug_position *)(info->locals + info->locals_size);
+	memcpy(info->locals, debug->locals, info->locals_size * sizeof(dex_debug_local));
+	memcpy(info->positions, debug->positions, info->positions_size * sizeof(dex_debug_position));
+
+	debug->methods[method_idx] = info;
+	return info;
+}
+
+/* source line of the instruction at address, 0 when the table has none before it */
+u4 dex_debug_line(const dex_debug_info *info, u4 address)
+{
+	u4 lo = 0, hi = info->positions_size, mid;
+
+	/* positions are in address order, find the last one at or before address */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (info->positions[mid].address <= address)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo ? info->positions[lo - 1].line : 0;
+}
@@ -24,127 +24,53 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <getopt.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#define VERSION "0.1"
+#include "dexinfo.h"
 
-#define MAX_BUFSIZE 1024
+#define VERSION "0.1"
 
 #ifdef PYDEXINFO
 
-size_t dexinfo_read(uint8_t * buf, size_t len);
-void   dexinfo_seek(off_t offset, int whence);
-
-#define psseek(f, off, whence)		dexinfo_seek(off, whence)
-#define psread(buf, len, nmemb, f)	dexinfo_read((uint8_t *)buf, (len * nmemb))
-
-#define psprintf( ... )					\
-{							\
-	char tmp[MAX_BUFSIZE];				\
-	snprintf(tmp, MAX_BUFSIZE, __VA_ARGS__);	\
-	printbuf_write(tmp);				\
-}
-
 static char * printbuf = NULL;
 static size_t printbuf_len = 0;
+static size_t printbuf_alloc = 0;
 
-static void printbuf_write(char * data)
+/* the buffer doubles, so a parse reallocates it a few dozen times at most */
+void printbuf_write(char * data)
 {
 	size_t len = strlen(data);
+	size_t alloc;
+	char * buf;
 
-	if ((printbuf = realloc(printbuf, printbuf_len + len)) == NULL)
+	if (printbuf_len + len + 1 > printbuf_alloc)
 	{
-		printf("Error allocating output buffer");
+		alloc = printbuf_alloc ? printbuf_alloc : 4096;
+		while (alloc < printbuf_len + len + 1)
+			alloc *= 2;
 
-		return;
+		if ((buf = realloc(printbuf, alloc)) == NULL)
+		{
+			printf("Error allocating output buffer");
+
+			return;
+		}
+
+		printbuf = buf;
+		printbuf_alloc = alloc;
 	}
 
-	memset(printbuf + printbuf_len, 0, len);
-	memcpy(printbuf + printbuf_len, data, len);
+	memcpy(printbuf + printbuf_len, data, len + 1);
 	printbuf_len += len;
 }
 
-#else
-
-#define psseek(f, off, whence)		fseek(f, off, whence);
-
-#define psread(buf, len, nmemb, f)	fread(buf, len, nmemb, f)
-
-#define psprintf( ... )					\
-		printf( __VA_ARGS__ );
 #endif
 
-typedef uint8_t             u1;
-typedef uint16_t            u2;
-typedef uint32_t            u4;
-typedef uint64_t            u8;
-typedef int8_t              s1;
-typedef int16_t             s2;
-typedef int32_t             s4;
-typedef int64_t             s8;
-
-
-typedef struct {
-	char dex[3];
-	char newline[1];
-	char ver[3];
-	char zero[1];
-} dex_magic;
-
-typedef struct {
-	dex_magic magic;
-	u4 checksum[1];
-	unsigned char signature[20];
-	u4 file_size[1];
-	u4 header_size[1];
-	u4 endian_tag[1];
-	u4 link_size[1];
-	u4 link_off[1];
-	u4 map_off[1];
-	u4 string_ids_size[1];
-	u4 string_ids_off[1];
-	u4 type_ids_size[1];
-	u4 type_ids_off[1];
-	u4 proto_ids_size[1];
-	u4 proto_ids_off[1];
-	u4 field_ids_size[1];
-	u4 field_ids_off[1];
-	u4 method_ids_size[1];
-	u4 method_ids_off[1];
-	u4 class_defs_size[1];
-	u4 class_defs_off[1];
-	u4 data_size[1];
-	u4 data_off[1];
-} dex_header;
-
-typedef struct {
-	u4 class_idx[1];
-	u4 access_flags[1];
-	u4 superclass_idx[1];
-	u4 interfaces_off[1];
-	u4 source_file_idx[1];
-	u4 annotations_off[1];
-	u4 class_data_off[1];
-	u4 static_values_off[1];
-} class_def_struct;
-
-typedef struct {
-	u2 class_idx[1];
-	u2 proto_idx[1];
-	u4 name_idx[1];
-} method_id_struct;
-
-typedef struct {
-	u4 string_data_off[1];
-} string_id_struct;
-
-typedef struct {
-	u4 descriptor_idx[1];
-} type_id_struct;
-
-typedef struct {
-	u4 descriptor_idx[1];
-} proto_id_struct;
-
 /*names for the access flags*/
 const char * ACCESS_FLAG_NAMES[20] = {
     "public",
@@ -269,32 +195,346 @@ size_t len_uleb128(unsigned long n)
     while (b[i++] & 0x80);
     return i;
 }
-/*wrote this to avoid dumping the leb128 parsing and grabbing code all over the place ;)*/
-void 
-printUnsignedLebValue(char *format,
-							u1 *stringData,
-							size_t offset,
-							FILE* DexFile){
+/* bounded readUnsignedLeb128 for data reached through file offsets, stops at the end of the image */
+u4 dex_uleb128(const dex_image *dex, u1 **pStream)
+{
+	u1 *ptr = *pStream;
+	u1 *end = dex->base + dex->size;
+	u4 result = 0;
+	int shift = 0;
+
+	while (ptr < end) {
+		u1 cur = *(ptr++);
+		result |= (u4)(cur & 0x7f) << shift;
+		if (!(cur & 0x80) || (shift += 7) > 28)
+			break;
+	}
+
+	*pStream = ptr;
+	return result;
+}
 
-	u1 *uLebBuff;
-	int uLebValue, uLebValueLength;
+/* bounded signed LEB128, same rules as dex_uleb128() */
+s4 dex_sleb128(const dex_image *dex, u1 **pStream)
+{
+	u1 *ptr = *pStream;
+	u1 *end = dex->base + dex->size;
+	u4 result = 0;
+	int shift = 0;
+	u1 cur = 0;
+
+	while (ptr < end) {
+		cur = *(ptr++);
+		result |= (u4)(cur & 0x7f) << shift;
+		shift += 7;
+		if (!(cur & 0x80) || shift > 28)
+			break;
+	}
 
-	psseek(DexFile,offset,SEEK_SET); /*move position to the string in data section*/
-	uLebBuff = malloc(10*sizeof(u1))	;
-	psread(uLebBuff,1,sizeof(uLebBuff),DexFile);
+	if (shift < 32 && (cur & 0x40))
+		result |= ~0u << shift;
 
-	uLebValue = uleb128_value(uLebBuff);	
-	uLebValueLength = len_uleb128(uLebValue);
-	stringData = malloc(uLebValue * sizeof(u1)+1);
-	
-	psseek(DexFile, offset+uLebValueLength ,SEEK_SET);
-	psread(stringData,1,uLebValue,DexFile);
+	*pStream = ptr;
+	return (s4)result;
+}
+
+/*
+ * Small non-cryptographic hash used to compare code and names between dex
+ * files. Eight bytes at a time, finished with the murmur3 avalanche.
+ */
+u8 dex_hash_mix(u8 h, u8 v)
+{
+	h ^= v * 0x9e3779b97f4a7c15ULL;
+	h = (h << 31) | (h >> 33);
+	return h * 0xff51afd7ed558ccdULL;
+}
+
+u8 dex_hash(const void *data, size_t len, u8 seed)
+{
+	const u1 *ptr = data;
+	u8 h = seed ^ len, v;
+
+	for (; len >= 8; ptr += 8, len -= 8) {
+		memcpy(&v, ptr, 8);
+		h = dex_hash_mix(h, v);
+	}
+
+	if (len) {
+		v = 0;
+		memcpy(&v, ptr, len);
+		h = dex_hash_mix(h, v);
+	}
+
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/* every table the decoder indexes has to be inside the image */
+static int dex_map_tables(dex_image *dex)
+{
+	dex_header *header = dex->header;
+
+	if (!dex_in_image(dex, *header->string_ids_off, (u8)*header->string_ids_size * sizeof(string_id_struct)) ||
+	    !dex_in_image(dex, *header->type_ids_off, (u8)*header->type_ids_size * sizeof(type_id_struct)) ||
+	    !dex_in_image(dex, *header->proto_ids_off, (u8)*header->proto_ids_size * sizeof(proto_id_struct)) ||
+	    !dex_in_image(dex, *header->field_ids_off, (u8)*header->field_ids_size * sizeof(field_id_struct)) ||
+	    !dex_in_image(dex, *header->method_ids_off, (u8)*header->method_ids_size * sizeof(method_id_struct)) ||
+	    !dex_in_image(dex, *header->class_defs_off, (u8)*header->class_defs_size * sizeof(class_def_struct))) {
+		fprintf(stderr, "ERROR: invalid file length in dex header?\n");
+		return -1;
+	}
+
+	dex->string_ids = (string_id_struct *)(dex->base + *header->string_ids_off);
+	dex->type_ids = (type_id_struct *)(dex->base + *header->type_ids_off);
+	dex->proto_ids = (proto_id_struct *)(dex->base + *header->proto_ids_off);
+	dex->field_ids = (field_id_struct *)(dex->base + *header->field_ids_off);
+	dex->method_ids = (method_id_struct *)(dex->base + *header->method_ids_off);
+	dex->class_defs = (class_def_struct *)(dex->base + *header->class_defs_off);
+
+	return 0;
+}
+
+static void dex_alloc_error(const dex_arena *arena)
+{
+	if (arena->exceeded)
+		fprintf(stderr, "ERROR: memory limit of %zu bytes exceeded!\n", arena->limit);
+	else
+		fprintf(stderr, "ERROR: could not allocate memory!\n");
+}
+
+/*
+ * Load the dex file into memory. The command line tool maps the file, the
+ * python module pulls it through the read callback once, into the arena.
+ * With header_only set the python module stops after the header.
+ */
+int dex_load(dex_image *dex, char *dexfile, int header_only, dex_arena *arena)
+{
+	memset(dex, 0, sizeof(*dex));
+	dex->arena = arena;
+
+#ifndef PYDEXINFO
+	int fd;
+	struct stat st;
+
+	fd = open(dexfile, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "ERROR: Can't open dex file!\n");
+		perror(dexfile);
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(dex_header)) {
+		fprintf(stderr, "ERROR: not a dex file\n");
+		close(fd);
+		return -1;
+	}
+
+	dex->base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (dex->base == MAP_FAILED) {
+		dex->base = NULL;
+		perror(dexfile);
+		return -1;
+	}
+	dex->size = st.st_size;
+	dex->mapped = 1;
+#else
+	dex_header tmp;
+	ssize_t len;
+
+	psseek(NULL, 0, SEEK_SET);
+	if (psread(&tmp, 1, sizeof(tmp), NULL) != sizeof(tmp)) {
+		fprintf(stderr, "ERROR: not a dex file\n");
+		return -1;
+	}
+
+	len = header_only ? sizeof(tmp) : *tmp.file_size;
+	if (len < (ssize_t)sizeof(tmp))
+		len = sizeof(tmp);
+
+	dex->base = dex_arena_alloc(arena, len);
+	if (dex->base == NULL) {
+		dex_alloc_error(arena);
+		return -1;
+	}
+
+	memcpy(dex->base, &tmp, sizeof(tmp));
+	dex->size = sizeof(tmp);
+	if (!header_only) {
+		psseek(NULL, 0, SEEK_SET);
+		len = psread(dex->base, 1, len, NULL);
+		if (len >= (ssize_t)sizeof(tmp))
+			dex->size = len;
+	}
+#endif
+
+	dex->header = (dex_header *)dex->base;
+	if (header_only)
+		return 0;
+
+	if (dex_map_tables(dex) < 0) {
+		dex_unload(dex);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* a dex file that is already in memory, base must outlive the image */
+int dex_load_memory(dex_image *dex, u1 *base, size_t size, dex_arena *arena)
+{
+	memset(dex, 0, sizeof(*dex));
+	dex->arena = arena;
+
+	if (base == NULL || size < sizeof(dex_header)) {
+		fprintf(stderr, "ERROR: not a dex file\n");
+		return -1;
+	}
+
+	dex->base = base;
+	dex->size = size;
+	dex->borrowed = 1;
+	dex->header = (dex_header *)base;
+
+	if (dex_map_tables(dex) < 0) {
+		memset(dex, 0, sizeof(*dex));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* only a mapped file is given back here, an image read into the arena goes with it */
+void dex_unload(dex_image *dex)
+{
+	if (dex->base && dex->mapped && !dex->borrowed)
+		munmap(dex->base, dex->size);
+
+	memset(dex, 0, sizeof(*dex));
+}
+
+/* string_data_item at offset: uleb128 utf16 size followed by NUL terminated MUTF-8 */
+static const char * dex_string_at(const dex_image *dex, size_t offset)
+{
+	u1 *ptr, *end;
+
+	if (offset >= dex->size)
+		return NULL;
+
+	/* skip the utf16 size, the string itself is NUL terminated */
+	ptr = dex->base + offset;
+	end = dex->base + dex->size;
+	while (ptr < end && (*ptr++ & 0x80))
+		;
+
+	if (ptr >= end || memchr(ptr, 0, end - ptr) == NULL)
+		return NULL;
+
+	return (const char *)ptr;
+}
+
+const char * dex_string(const dex_image *dex, u4 string_idx)
+{
+	if (string_idx >= *dex->header->string_ids_size)
+		return NULL;
+
+	return dex_string_at(dex, *dex->string_ids[string_idx].string_data_off);
+}
+
+const char * dex_type_desc(const dex_image *dex, u4 type_idx)
+{
+	if (type_idx >= *dex->header->type_ids_size)
+		return NULL;
+
+	return dex_string(dex, *dex->type_ids[type_idx].descriptor_idx);
+}
+
+/* next UTF-16 code unit of a MUTF-8 string, -1 at its end; a stray byte stands for itself */
+static s4 next_utf16(const u1 **ptr)
+{
+	const u1 *p = *ptr;
+
+	if (p[0] == 0)
+		return -1;
+	if ((p[0] & 0xe0) == 0xc0 && (p[1] & 0xc0) == 0x80) {
+		*ptr = p + 2;
+		return ((p[0] & 0x1f) << 6) | (p[1] & 0x3f);
+	}
+	if ((p[0] & 0xf0) == 0xe0 && (p[1] & 0xc0) == 0x80 && (p[2] & 0xc0) == 0x80) {
+		*ptr = p + 3;
+		return ((p[0] & 0x0f) << 12) | ((p[1] & 0x3f) << 6) | (p[2] & 0x3f);
+	}
+	*ptr = p + 1;
+	return p[0];
+}
 
-	stringData[uLebValue]='\0';	
+/*
+ * The order of string_ids: by UTF-16 code units, which strcmp() on MUTF-8
+ * only agrees with until a NUL (C0 80) or a non-BMP character comes up.
+ */
+int dex_string_compare(const char *a, const char *b)
+{
+	const u1 *x = (const u1 *)a, *y = (const u1 *)b;
+	s4 cx, cy;
+
+	/* ASCII bytes are whole characters, so a common ASCII prefix is skipped as bytes */
+	while (*x && *x == *y && *x < 0x80) {
+		x++;
+		y++;
+	}
+
+	do {
+		cx = next_utf16(&x);
+		cy = next_utf16(&y);
+	} while (cx == cy && cx >= 0);
+
+	return (cx > cy) - (cx < cy);
+}
+
+/* type_ids are sorted by descriptor, so a type is found by binary search */
+u4 dex_find_type(const dex_image *dex, const char *desc)
+{
+	u4 lo = 0, hi = *dex->header->type_ids_size, mid;
+	const char *str;
+	int cmp;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		str = dex_type_desc(dex, mid);
+		if (str == NULL)
+			return NO_INDEX;
+
+		cmp = dex_string_compare(str, desc);
+		if (cmp == 0)
+			return mid;
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return NO_INDEX;
+}
+
+/* type_list at off: u4 size followed by size u2 type indexes */
+const u2 * dex_type_list(const dex_image *dex, u4 off, u4 *size)
+{
+	u4 n;
+
+	*size = 0;
+	if (off == 0 || !dex_in_image(dex, off, sizeof(u4)))
+		return NULL;
 
-	psprintf(format,stringData);
-	free(uLebBuff);
+	n = *(u4 *)(dex->base + off);
+	if (!dex_in_image(dex, off + sizeof(u4), (u8)n * sizeof(u2)))
+		return NULL;
+
+	*size = n;
+	return (const u2 *)(dex->base + off + sizeof(u4));
 }
+
 /*this allows us to print ACC_FLAGS symbolically*/
 void parseAccessFlags(u4 flags){
 	int i = 0;
@@ -307,497 +547,1669 @@ void parseAccessFlags(u4 flags){
 	}
 	psprintf("\n");
 }
-/*not entirely sure how I should use these methods, as is they are only usefull for printing values, and don't return them :/
-though as a tradeoff I've made the methods manipulate the string data in place, so the conversion to returning them would be easy */
-/*Generic methods for printing types*/
+/*Generic methods for printing types, the strings are used in place from the dex image*/
 void
-printStringValue(string_id_struct *strIdList,
+printStringValue(const dex_image *dex,
 				u4 offset_pointer,
-				FILE* DexFile,
-				u1* stringData,
 				char* format){
 
-	size_t strIdOff;
+	const char *str;
 	if (offset_pointer){
-		//printf("strIdOff = %p\n", strIdList[offset_pointer].string_data_off);
-		strIdOff = *strIdList[offset_pointer].string_data_off; /*get the offset to the string in the data section*/
 		/*would be cool if we have a RAW mode, with only hex unparsed data, and a SYMBOLIC mode where all the data is parsed and interpreted */
-		printUnsignedLebValue(format,stringData,strIdOff,DexFile);
+		str = dex_string(dex, offset_pointer);
+		psprintf(format, str ? str : "(invalid)");
 	}
 	else{
 		psprintf("none\n");
 	}
-	free(stringData);
-	stringData=NULL;
 
 }
 
 void
-printTypeDesc(string_id_struct *strIdList,
-				type_id_struct* typeIdList,
+printTypeDesc(const dex_image *dex,
 				u4 offset_pointer,
-				FILE* DexFile,
-				u1* stringData,
 				char* format){
 
-	size_t strIdOff;
+	const char *str;
 	if (offset_pointer){
-		strIdOff = *strIdList[*typeIdList[offset_pointer].descriptor_idx].string_data_off; /*get the offset to the string in the data section*/
-		/*would be cool if we have a RAW mode, with only hex unparsed data, and a SYMBOLIC mode where all the data is parsed and interpreted */
-		printUnsignedLebValue(format,stringData,strIdOff,DexFile);
+		str = dex_type_desc(dex, offset_pointer);
+		psprintf(format, str ? str : "(invalid)");
 	}
 	else{
 		psprintf("none\n");
 	}
-	free(stringData);
-	stringData=NULL;
 
 }
 void 
-printClassFileName(string_id_struct *strIdList, 
-				class_def_struct classDefItem,
-				FILE *DexFile,
-				u1* stringData){
+printClassFileName(const dex_image *dex,
+				const class_def_struct *classDefItem){
 
-	size_t strIdOff;
-	if (classDefItem.source_file_idx){
-		strIdOff = *strIdList[*classDefItem.source_file_idx].string_data_off; /*get the offset to the string in the data section*/
-		printUnsignedLebValue("(%s)\n",stringData,strIdOff,DexFile);
+	const char *str;
+	if (*classDefItem->source_file_idx){
+		str = dex_string(dex, *classDefItem->source_file_idx);
+		psprintf("(%s)\n", str ? str : "(invalid)");
 	}
 	else{
 		psprintf("none\n");
 	}
-	free(stringData);
-	stringData=NULL;
 	
 }
 void
-printTypeDescForClass(string_id_struct *strIdList, 
-				type_id_struct* typeIdList,
-				class_def_struct classDefItem,
-				FILE *DexFile,
-				u1* stringData){
-	size_t strIdOff;
-	if (classDefItem.class_idx){
-	strIdOff = *strIdList[*typeIdList[*classDefItem.class_idx].descriptor_idx].string_data_off; /*get the offset to the string in the data section*/
-	printUnsignedLebValue("%s\n",stringData,strIdOff,DexFile);
-	free(stringData);
-	stringData=NULL;
+printTypeDescForClass(const dex_image *dex,
+				const class_def_struct *classDefItem){
+	const char *str;
+	if (*classDefItem->class_idx){
+		str = dex_type_desc(dex, *classDefItem->class_idx);
+		psprintf("%s\n", str ? str : "(invalid)");
 	}
 	else{
 		psprintf("none\n");
 	}
 }
-void parseClass(){
-
-}
-void parseHeader(){
-
-}
-void help_show_message()
+static const char * visibilityName(u1 visibility)
 {
-	fprintf(stderr, "Usage: dexinfo <file.dex> [options]\n");
-	fprintf(stderr, " options:\n");
-	fprintf(stderr, "    -V             print verbose information\n");
+	switch (visibility) {
+	case DEX_VISIBILITY_BUILD:
+		return "build";
+	case DEX_VISIBILITY_RUNTIME:
+		return "runtime";
+	case DEX_VISIBILITY_SYSTEM:
+		return "system";
+	}
+	return "unknown";
 }
 
-char * dexinfo(char * dexfile, int DEBUG)
+/* "class", "field <name>", "method <name>" or "method <name> parameter <n>" */
+static void printAnnotationTarget(const dex_image *dex, const dex_annotation_hit *hit)
 {
-	// char *dexfile;
-	FILE *input = NULL;
-	size_t offset, offset2;
-	ssize_t len;
-	int i,c;
-	// int DEBUG=0;
+	const char *str = NULL;
 
-	int static_fields_size;
-	int instance_fields_size;
-	int direct_methods_size;
-	int virtual_methods_size; 
+	switch (hit->kind) {
+	case DEX_ANNOTATION_CLASS:
+		psprintf("class");
+		return;
+	case DEX_ANNOTATION_FIELD:
+		if (hit->member_idx < *dex->header->field_ids_size)
+			str = dex_string(dex, *dex->field_ids[hit->member_idx].name_idx);
+		psprintf("field %s", str ? str : "(invalid)");
+		return;
+	}
 
-	int field_idx_diff;
-	int field_access_flags;
+	if (hit->member_idx < *dex->header->method_ids_size)
+		str = dex_string(dex, *dex->method_ids[hit->member_idx].name_idx);
+	psprintf("method %s", str ? str : "(invalid)");
+	if (hit->kind == DEX_ANNOTATION_PARAMETER)
+		psprintf(" parameter %u", hit->param);
+}
 
-	int method_idx_diff;
-	int method_access_flags;
-	int method_code_off;
+static void printValue(const dex_image *dex, const dex_value *value);
 
-	int key;
+/* "(name=value, ...)" for an annotation with elements */
+static void printAnnotationElements(const dex_image *dex, const dex_annotation *annotation)
+{
+	dex_value_iter it;
+	dex_value value;
+	const char *name;
+	u4 name_idx;
+	int i = 0;
 
-	dex_header header;
-	class_def_struct class_def_item;
-	u1* buffer;
-	u1* buf;
-	u1* buffer_pos;
-	u1* str=NULL;
+	if (annotation->size == 0)
+		return;
 
-	method_id_struct method_id_item;
-	method_id_struct* method_id_list;
+	psprintf("(");
+	dex_annotation_elements(dex, annotation, &it);
+	while (dex_value_next(&it, &name_idx, &value) > 0) {
+		name = dex_string(dex, name_idx);
+		psprintf("%s%s=", i++ ? ", " : "", name ? name : "(invalid)");
+		printValue(dex, &value);
+	}
+	psprintf(")");
+}
 
-	string_id_struct string_id_item;
-	string_id_struct* string_id_list;
+/* "Lclass;->name" for field and method references */
+static void printMemberRef(const dex_image *dex, u4 class_idx, u4 name_idx)
+{
+	const char *desc = dex_type_desc(dex, class_idx);
+	const char *name = dex_string(dex, name_idx);
 
-	type_id_struct type_id_item;
-	type_id_struct* type_id_list;
+	psprintf("%s->%s", desc ? desc : "(invalid)", name ? name : "(invalid)");
+}
 
-	int size_uleb, size_uleb_value;
+static void printValue(const dex_image *dex, const dex_value *value)
+{
+	dex_value_iter it;
+	dex_value item;
+	const char *str;
+	int i = 0;
 
-#ifdef PYDEXINFO
-	if (!printbuf)
-	{
-	}
-	else
-	{
-		free(printbuf);
-		printbuf = NULL;
-		printbuf_len = 0;
+	switch (value->type) {
+	case VALUE_BYTE:
+	case VALUE_SHORT:
+	case VALUE_INT:
+	case VALUE_LONG:
+		psprintf("%lld", (long long)value->v.s);
+		break;
+	case VALUE_CHAR:
+		if (value->v.s >= 0x20 && value->v.s < 0x7f) {
+			psprintf("'%c'", (int)value->v.s);
+		} else {
+			psprintf("'\\u%04x'", (unsigned int)value->v.s);
+		}
+		break;
+	case VALUE_FLOAT:
+		psprintf("%gf", value->v.f);
+		break;
+	case VALUE_DOUBLE:
+		psprintf("%g", value->v.d);
+		break;
+	case VALUE_STRING:
+		str = dex_string(dex, value->v.idx);
+		psprintf("\"%s\"", str ? str : "(invalid)");
+		break;
+	case VALUE_TYPE:
+		str = dex_type_desc(dex, value->v.idx);
+		psprintf("%s", str ? str : "(invalid)");
+		break;
+	case VALUE_FIELD:
+	case VALUE_ENUM:
+		if (value->v.idx < *dex->header->field_ids_size)
+			printMemberRef(dex, *dex->field_ids[value->v.idx].class_idx, *dex->field_ids[value->v.idx].name_idx);
+		else
+			psprintf("(invalid)");
+		break;
+	case VALUE_METHOD:
+		if (value->v.idx < *dex->header->method_ids_size)
+			printMemberRef(dex, *dex->method_ids[value->v.idx].class_idx, *dex->method_ids[value->v.idx].name_idx);
+		else
+			psprintf("(invalid)");
+		break;
+	case VALUE_METHOD_TYPE:
+		psprintf("proto@%u", value->v.idx);
+		break;
+	case VALUE_METHOD_HANDLE:
+		psprintf("method_handle@%u", value->v.idx);
+		break;
+	case VALUE_ARRAY:
+		psprintf("[");
+		dex_array_values(dex, value, &it);
+		while (dex_value_next(&it, NULL, &item) > 0) {
+			psprintf("%s", i++ ? ", " : "");
+			printValue(dex, &item);
+		}
+		psprintf("]");
+		break;
+	case VALUE_ANNOTATION:
+		str = dex_type_desc(dex, value->v.annotation.type_idx);
+		psprintf("@%s", str ? str : "(invalid)");
+		printAnnotationElements(dex, &value->v.annotation);
+		break;
+	case VALUE_NULL:
+		psprintf("null");
+		break;
+	case VALUE_BOOLEAN:
+		psprintf("%s", value->v.z ? "true" : "false");
+		break;
 	}
-#endif
+}
 
-	psprintf ("\n=== dexinfo %s - (c) 2012-2013 Pau Oliva Fora\n\n", VERSION);
+/* verbose listing, one line per annotation under annotations_off */
+static void printAnnotation(const dex_image *dex, const dex_annotation_hit *hit, void *ctx)
+{
+	const char *desc = dex_type_desc(dex, hit->annotation.type_idx);
 
-#ifndef PYDEXINFO
-	input = fopen(dexfile, "rb");
-	if (input == NULL) {
-		fprintf(stderr, "ERROR: Can't open dex file!\n");
-		perror(dexfile);
-#ifndef PYDEXINFO
-			exit(1);
-#else
-			return NULL;
-#endif
-	}
-#endif
+	psprintf("\t\t");
+	printAnnotationTarget(dex, hit);
+	psprintf(" annotation %s", desc ? desc : "(invalid)");
+	printAnnotationElements(dex, &hit->annotation);
+	psprintf(" (%s)\n", visibilityName(hit->annotation.visibility));
+}
 
-	/* print dex header information */
-        psprintf ("[] Dex file: %s\n\n",dexfile);
+/* -a listing, the annotation type is already known */
+static void printAnnotationMatch(const dex_image *dex, const dex_annotation_hit *hit, void *ctx)
+{
+	const char *desc = dex_type_desc(dex, *dex->class_defs[hit->class_def_idx].class_idx);
 
-	memset(&header, 0, sizeof(header));
-	memset(&class_def_item, 0, sizeof(class_def_item));
+	psprintf("[] Class %u %s: ", hit->class_def_idx + 1, desc ? desc : "(invalid)");
+	printAnnotationTarget(dex, hit);
+	psprintf(" (%s)\n", visibilityName(hit->annotation.visibility));
+}
 
-	psread(&header, 1, sizeof(header), input);
+typedef struct {
+	const dexinfo_options *opts;
+	int found;
+} hierarchy_query;
 
-	psprintf ("[] DEX magic: ");
-	for (i=0;i<3;i++) psprintf("%02X ", header.magic.dex[i]);
-	psprintf("%02X ", *header.magic.newline);
-	for (i=0;i<3;i++) psprintf("%02X ", header.magic.ver[i]);
-	psprintf("%02X ", *header.magic.zero);
-	psprintf ("\n");
+static void printHierarchyClass(const dex_image *dex, u4 type_idx, u4 class_def_idx, void *ctx)
+{
+	hierarchy_query *query = ctx;
+	const char *desc = dex_type_desc(dex, type_idx);
 
-	if ( (strncmp(header.magic.dex,"dex",3) != 0) || 
-	     (strncmp(header.magic.newline,"\n",1) != 0) || 
-	     (strncmp(header.magic.zero,"\0",1) != 0 ) ) {
-		fprintf (stderr, "ERROR: not a dex file\n");
-#ifndef PYDEXINFO
-			fclose(input);
+	if (query->opts->class_filter && (desc == NULL || fnmatch(query->opts->class_filter, desc, 0) != 0))
+		return;
 
-			exit(1);
-#else
-			return NULL;
-#endif
-	}
+	query->found++;
 
-	psprintf ("[] DEX version: %s\n", header.magic.ver);
-	if (strncmp(header.magic.ver,"035",3) != 0) {
-		fprintf (stderr,"Warning: Dex file version != 035\n");
+	if (class_def_idx == NO_INDEX) {
+		psprintf("[] %s (not in this dex)\n", desc ? desc : "(invalid)");
+	} else {
+		psprintf("[] Class %u %s\n", class_def_idx + 1, desc ? desc : "(invalid)");
 	}
+}
 
-	psprintf ("[] Adler32 checksum: 0x%x\n", *header.checksum);
+/* what fits a psprintf() line with the text around it */
+#define DESC_PRINT_MAX	(MAX_BUFSIZE - 64)
 
-	psprintf ("[] SHA1 signature: ");
-	for (i=0;i<20;i++) psprintf("%02x", header.signature[i]);
-	psprintf("\n");
+/* -S, -I and -A: the index is built once and serves every type in the comma separated list */
+static int queryHierarchy(const dex_image *dex, dex_hierarchy *cached, const dexinfo_options *opts)
+{
+	dex_hierarchy built, *hierarchy = cached;
+	hierarchy_query query;
+	char desc[MAX_BUFSIZE];
+	const char *types = opts->type ? opts->type : "";
+	const char *label;
+	size_t len;
+	u4 type_idx;
+
+	if (hierarchy == NULL) {
+		hierarchy = &built;
+		if (dex_hierarchy_build(dex, hierarchy) < 0) {
+			dex_alloc_error(dex->arena);
+			return -1;
+		}
+		/* stopped by the budget, dexinfo() says so */
+		if (dex->budget && dex->budget->status)
+			return 0;
+	}
 
-	if (DEBUG) {
-		psprintf ("[] File size: %d bytes\n", *header.file_size);
-		psprintf ("[] DEX Header size: %d bytes (0x%x)\n", *header.header_size, *header.header_size);
+	label = opts->mode == DEXINFO_MODE_SUBCLASSES ? "Subclasses" :
+		opts->mode == DEXINFO_MODE_IMPLEMENTORS ? "Implementors" : "Ancestors";
+
+	while (*types) {
+		len = strcspn(types, ",");
+		if (len >= sizeof(desc))
+			len = sizeof(desc) - 1;
+		memcpy(desc, types, len);
+		desc[len] = '\0';
+		types += strcspn(types, ",");
+		if (*types == ',')
+			types++;
+
+		type_idx = dex_find_type(dex, desc);
+		if (type_idx == NO_INDEX) {
+			psprintf("[] Type %.*s is not used in this dex\n", DESC_PRINT_MAX, desc);
+			continue;
+		}
+
+		query.opts = opts;
+		query.found = 0;
+
+		psprintf("[] %s of %.*s\n", label, DESC_PRINT_MAX, desc);
+		if (opts->mode == DEXINFO_MODE_ANCESTORS)
+			dex_hierarchy_ancestors(dex, hierarchy, type_idx, printHierarchyClass, &query);
+		else
+			dex_hierarchy_descendants(dex, hierarchy, type_idx,
+				opts->mode == DEXINFO_MODE_SUBCLASSES ? DEX_HIERARCHY_SUBCLASSES :
+					DEX_HIERARCHY_SUBCLASSES | DEX_HIERARCHY_IMPLEMENTORS,
+				printHierarchyClass, &query);
+		psprintf("[] Total: %d classes\n", query.found);
 	}
 
-	if (*header.header_size != 0x70) {
-		fprintf (stderr,"Warning: Header size != 0x70\n");
+	return 0;
+}
+
+typedef struct {
+	const dexinfo_options *opts;
+	int skip;		/* class filtered out, skip its members too */
+	int added;
+	int removed;
+	int changed;
+} diff_query;
+
+static void printDiffReasons(u4 reasons)
+{
+	static const char *names[] = { "flags", "superclass", "interfaces", "fields", "methods", "code" };
+	const char *sep = " (";
+	int i;
+
+	for (i = 0; i < 6; i++) {
+		if (reasons & (1u << i)) {
+			psprintf("%s%s", sep, names[i]);
+			sep = ", ";
+		}
 	}
+	if (reasons)
+		psprintf(")");
+}
 
-	if (DEBUG) psprintf("[] Endian Tag: 0x%x\n", *header.endian_tag);
-	if (*header.endian_tag != 0x12345678) {
-		fprintf (stderr,"Warning: Endian tag != 0x12345678\n");
+/* name(params)return for methods, name:type for fields */
+static void printMemberSignature(const dex_image *dex, int what, u4 idx)
+{
+	const proto_id_struct *proto;
+	const u2 *params;
+	const char *str;
+	u4 i, n;
+
+	if (what == DEX_DIFF_FIELD) {
+		if (idx >= *dex->header->field_ids_size) {
+			psprintf("(invalid)");
+			return;
+		}
+		str = dex_string(dex, *dex->field_ids[idx].name_idx);
+		psprintf("%s:", str ? str : "(invalid)");
+		str = dex_type_desc(dex, *dex->field_ids[idx].type_idx);
+		psprintf("%s", str ? str : "(invalid)");
+		return;
 	}
 
-	if (DEBUG) {
-		psprintf("[] Link size: %d\n", *header.link_size);
-		psprintf("[] Link offset: 0x%x\n", *header.link_off);
-		psprintf("[] Map list offset: 0x%x\n", *header.map_off);
-		psprintf("[] Number of strings in string ID list: %d\n", *header.string_ids_size);
-		psprintf("[] String ID list offset: 0x%x\n", *header.string_ids_off);
-		psprintf("[] Number of types in the type ID list: %d\n", *header.type_ids_size);
-		psprintf("[] Type ID list offset: 0x%x\n", *header.type_ids_off);
-		psprintf("[] Number of items in the method prototype ID list: %d\n", *header.proto_ids_size);
-		psprintf("[] Method prototype ID list offset: 0x%x\n", *header.proto_ids_off);
-		psprintf("[] Number of item in the field ID list: %d\n", *header.field_ids_size);
-		psprintf("[] Field ID list offset: 0x%x\n", *header.field_ids_off);
-		psprintf("[] Number of items in the method ID list: %d\n", *header.method_ids_size);
-		psprintf("[] Method ID list offset: 0x%x\n", *header.method_ids_off);
-		psprintf("[] Number of items in the class definitions list: %d\n", *header.class_defs_size);
-		psprintf("[] Class definitions list offset: 0x%x\n", *header.class_defs_off);
-		psprintf("[] Data section size: %d bytes\n", *header.data_size);
-		psprintf("[] Data section offset: 0x%x\n", *header.data_off);
-	}
-
-	psprintf("\n[] Number of classes in the archive: %d\n", *header.class_defs_size);
-
-	/* parse the strings */
-	string_id_list = malloc(*header.string_ids_size*sizeof(string_id_item));
-	psseek(input, *header.string_ids_off, SEEK_SET);
-	psread(string_id_list, 1, *header.string_ids_size*sizeof(string_id_item), input);
-
-	/* parse the types */
-	type_id_list = malloc(*header.type_ids_size*sizeof(type_id_item));
-	psseek(input, *header.type_ids_off, SEEK_SET);
-	psread(type_id_list, 1, *header.type_ids_size*sizeof(type_id_item), input);
-
-	/* parse methods */
-	method_id_list = malloc(*header.method_ids_size*sizeof(method_id_item));
-	psseek(input, *header.method_ids_off, SEEK_SET);
-	psread(method_id_list, 1, *header.method_ids_size*sizeof(method_id_item), input);
+	if (idx >= *dex->header->method_ids_size || *dex->method_ids[idx].proto_idx >= *dex->header->proto_ids_size) {
+		psprintf("(invalid)");
+		return;
+	}
 
-#if 0
-	/* strings */
-	for (i=0;i < (*header.string_ids_size)*(sizeof(string_id_item)) ;i+=4) {
-		 psprintf("string_id_list[%d] (%x) = \n", i/4, *string_id_list[i/4].string_data_off);
+	str = dex_string(dex, *dex->method_ids[idx].name_idx);
+	psprintf("%s(", str ? str : "(invalid)");
+	proto = &dex->proto_ids[*dex->method_ids[idx].proto_idx];
+	params = dex_type_list(dex, *proto->parameters_off, &n);
+	for (i = 0; i < n; i++) {
+		str = dex_type_desc(dex, params[i]);
+		psprintf("%s", str ? str : "(invalid)");
 	}
-#endif
-#ifdef PYDEXINFO
+	str = dex_type_desc(dex, *proto->return_type_idx);
+	psprintf(")%s", str ? str : "(invalid)");
+}
 
-	/* methods */
-	for (i=0;i<sizeof(method_id_item)*(*header.method_ids_size);i+=8) {
-		// psprintf ("method_id_list[%d]class=%x\n", i/8, *method_id_list[i/8].class_idx);
-		// psprintf ("method_id_list[%d]proto=%x\n", i/8, *method_id_list[i/8].proto_idx);
-		// psprintf ("method_id_list[%d]name=%x\n", i/8, *method_id_list[i/8].name_idx);
-		printStringValue(string_id_list, *method_id_list[i/8].name_idx, input, str, "MethodVal %s\n");
+static void printDiffEntry(const dex_image *old_dex, const dex_image *new_dex, const dex_diff_entry *entry, void *ctx)
+{
+	static const char *kinds[] = { "Added", "Removed", "Changed" };
+	static const char *member_kinds[] = { "added", "removed", "changed" };
+	static const char *members[] = { "class", "field", "method" };
+	diff_query *query = ctx;
+	const dex_image *dex = entry->new_idx != NO_INDEX ? new_dex : old_dex;
+	u4 idx = entry->new_idx != NO_INDEX ? entry->new_idx : entry->old_idx;
+	const char *desc;
+
+	if (entry->what != DEX_DIFF_CLASS) {
+		if (query->skip)
+			return;
+		psprintf("\t%s %s ", member_kinds[entry->kind], members[entry->what]);
+		printMemberSignature(dex, entry->what, idx);
+		printDiffReasons(entry->reasons);
+		psprintf("\n");
+		return;
 	}
 
-#endif
+	desc = dex_type_desc(dex, *dex->class_defs[idx].class_idx);
+	query->skip = query->opts->class_filter && (desc == NULL || fnmatch(query->opts->class_filter, desc, 0) != 0);
+	if (query->skip)
+		return;
 
-	/*Parse class definitions*/
-	for (c=1; c <= (int)*header.class_defs_size; c++) { /*run through all the class */
-		// change the position to the class_def_struct of each class
-		offset = *header.class_defs_off + ((c-1)*sizeof(class_def_item)); /*get the offset for this class definition*/
-		psseek(input, offset, SEEK_SET);
-		psprintf("[] Class %d ", c);
-		psread(&class_def_item, 1, sizeof(class_def_item), input); /*read the class definition from the input*/
-		/* print class filename */
-		if (*class_def_item.source_file_idx != 0xffffffff) {
-			printClassFileName(string_id_list,class_def_item,input,str);
-		} else {
-			psprintf ("(No index): ");
-		}
+	if (entry->kind == DEX_DIFF_ADDED)
+		query->added++;
+	else if (entry->kind == DEX_DIFF_REMOVED)
+		query->removed++;
+	else
+		query->changed++;
 
-		if (DEBUG) {
-			psprintf("\n");
-			/* print type id */
-			psprintf("\tclass_idx='0x%x':", *class_def_item.class_idx);
-			printTypeDescForClass(string_id_list,type_id_list,class_def_item,input,str);
-			psprintf("\taccess_flags='0x%x':", *class_def_item.access_flags); /*need to interpret this*/
-			parseAccessFlags(*class_def_item.access_flags);
-			psprintf("\tsuperclass_idx='0x%x':", *class_def_item.superclass_idx);
-			printTypeDesc(string_id_list,type_id_list,*class_def_item.superclass_idx,input,str,"%s\n");
-			psprintf("\tinterfaces_off='0x%x'\n", *class_def_item.interfaces_off); /*need to look this up in the DexTypeList*/
-			psprintf("\tsource_file_idx='0x%x'\n", *class_def_item.source_file_idx);
-            if (*class_def_item.source_file_idx != NO_INDEX) 
-			printStringValue(string_id_list,*class_def_item.source_file_idx,input,str,"%s\n"); //causes a seg fault on some dex files
-            // The seg fault was because there was no index value on the
-            // class_def_item.scource_fie_idx
-		/*should implement decoding the annotations directory items, we can use this to idenfiy Javascript interface accessible methods*/
-			psprintf("\tannotations_off=0x%x\n", *class_def_item.annotations_off);
-			psprintf("\tclass_data_off=0x%x (%d)\n", *class_def_item.class_data_off, *class_def_item.class_data_off);
-			psprintf("\tstatic_values_off=0x%x (%d)\n", *class_def_item.static_values_off, *class_def_item.static_values_off);
-		}
+	psprintf("[] %s class %s", kinds[entry->kind], desc ? desc : "(invalid)");
+	printDiffReasons(entry->reasons);
+	psprintf("\n");
+}
 
-		// change position to class_data_off
-		if (*class_def_item.class_data_off == 0) {
-			if (DEBUG) {
-				psprintf ("\t0 static fields\n");
-				psprintf ("\t0 instance fields\n");
-				psprintf ("\t0 direct methods\n");
-			} else {
-				psprintf ("0 direct methods, 0 virtual methods\n");
-			}
-			continue;
-		} else {
+/* -D: what changed from this dex to the other one */
+static int queryDiff(const dex_image *dex, const dexinfo_options *opts)
+{
+	dex_image other;
+	diff_query query;
+	int ret;
 
-			offset = *class_def_item.class_data_off;
-			psseek(input, offset, SEEK_SET);
-		}
-
-		len = *header.map_off - offset;
-		if (len < 1) {
-			len = *header.file_size - offset;
-			if (len < 1) {
-				fprintf(stderr, "ERROR: invalid file length in dex header?\n");
-				fclose(input);
-#ifndef PYDEXINFO
-					exit(1);
+#ifdef PYDEXINFO
+	ret = dex_load_memory(&other, opts->other_data, opts->other_size, dex->arena);
 #else
-					return NULL;
+	ret = opts->other ? dex_load(&other, opts->other, 0, dex->arena) : -1;
 #endif
-			}
-		}
+	if (ret < 0)
+		return -1;
+	other.budget = dex->budget;
+
+	if (strncmp(other.header->magic.dex, "dex", 3) != 0) {
+		fprintf(stderr, "ERROR: not a dex file\n");
+		dex_unload(&other);
+		return -1;
+	}
 
-		buffer = malloc(len * sizeof(u1));
-		if (buffer == NULL) {
-			fprintf(stderr, "ERROR: could not allocate memory!\n");
-			fclose(input);
-#ifndef PYDEXINFO
-				exit(1);
-#else
-				return NULL;
-#endif
+	memset(&query, 0, sizeof(query));
+	query.opts = opts;
+
+	psprintf("[] Diff against %s\n", opts->other ? opts->other : "(memory)");
+	ret = dex_diff(dex, &other, printDiffEntry, &query);
+	if (ret < 0)
+		dex_alloc_error(dex->arena);
+	else if (dex->budget == NULL || dex->budget->status == DEX_BUDGET_OK)
+		psprintf("[] Total: %d added, %d removed, %d changed classes\n", query.added, query.removed, query.changed);
+
+	dex_unload(&other);
+	return ret;
+}
+
+/* -E: the class, field and method tables as columns */
+static int queryExport(const dex_image *dex, const dexinfo_options *opts)
+{
+	FILE *out;
+	u4 rows[DEX_EXPORT_TABLES];
+	int ret;
+
+	out = opts->output ? fopen(opts->output, "wb") : NULL;
+	if (out == NULL) {
+		fprintf(stderr, "ERROR: can't create %s\n", opts->output ? opts->output : "(none)");
+		return -1;
+	}
+
+	ret = dex_export(dex, opts->class_filter, out, rows);
+	if (fclose(out) != 0 && ret == 0)
+		ret = -1;
+	if (ret < 0 && dex->budget && dex->budget->status && !dex->arena->exceeded) {
+		/* stopped by the budget, dexinfo() says so */
+		remove(opts->output);
+		return 0;
+	}
+	if (ret < 0) {
+		if (dex->arena->exceeded)
+			dex_alloc_error(dex->arena);
+		else
+			fprintf(stderr, "ERROR: could not write %s\n", opts->output);
+		remove(opts->output);
+		return -1;
+	}
+
+	psprintf("[] Exported %u classes, %u fields, %u methods to %s\n",
+		rows[DEX_EXPORT_CLASSES], rows[DEX_EXPORT_FIELDS], rows[DEX_EXPORT_METHODS], opts->output);
+	return 0;
+}
+
+typedef struct {
+	u4 string_idx;
+	u4 class_def_idx;
+} string_ref;
+
+typedef struct {
+	const dexinfo_options *opts;
+	u4 matched;
+	int failed;
+	/* -V lists the classes using every string, so the strings wait for them */
+	dex_arena *arena;
+	u4 *hits;
+	char **strs;
+	u1 *valid;
+	u4 hits_alloc;
+	string_ref *refs;
+	u4 refs_size;
+	u4 refs_alloc;
+} strings_query;
+
+static void printString(u4 string_idx, const char *str, int valid)
+{
+	psprintf("[] String %u \"%s\"%s\n", string_idx, str, valid ? "" : " (invalid MUTF-8)");
+}
+
+static void printStringHit(const dex_image *dex, const dex_string_hit *hit, void *ctx)
+{
+	strings_query *query = ctx;
+	void *hits, *strs, *valid;
+	u4 alloc;
+
+	if (!query->opts->verbose) {
+		query->matched++;
+		printString(hit->string_idx, hit->str, hit->valid);
+		return;
+	}
+
+	if (query->failed)
+		return;
+	if (query->matched == query->hits_alloc) {
+		alloc = query->hits_alloc ? query->hits_alloc * 2 : 64;
+		hits = dex_arena_grow(query->arena, query->hits, query->hits_alloc * sizeof(u4), alloc * sizeof(u4));
+		strs = dex_arena_grow(query->arena, query->strs, query->hits_alloc * sizeof(char *), alloc * sizeof(char *));
+		valid = dex_arena_grow(query->arena, query->valid, query->hits_alloc, alloc);
+		if (hits == NULL || strs == NULL || valid == NULL) {
+			query->failed = 1;
+			return;
 		}
-		buffer_pos=buffer;
-		memset(buffer, 0, len);
-		psread(buffer, 1, len, input);
-
-		// from now on we continue on memory, as we have to parse uleb128
-		static_fields_size = readUnsignedLeb128(&buffer);
-		instance_fields_size = readUnsignedLeb128(&buffer);
-		direct_methods_size = readUnsignedLeb128(&buffer);
-		virtual_methods_size = readUnsignedLeb128(&buffer);
-
-		if (DEBUG) psprintf ("\t%d static fields\n", static_fields_size);
-
-		for (i=0;i<static_fields_size;i++) {
-			field_idx_diff = readUnsignedLeb128(&buffer);
-			field_access_flags = readUnsignedLeb128(&buffer);
-			if (DEBUG) {
-				psprintf ("\t\t[%d]|--field_idx_diff='0x%x'\n",i, field_idx_diff);
-				//printTypeDesc(string_id_list,type_id_list,field_idx_diff,input,str," %s\n");
-				psprintf ("\t\t    |--field_access_flags='0x%x'",field_access_flags);
-				parseAccessFlags(field_access_flags);
-			}
+		query->hits = hits;
+		query->strs = strs;
+		query->valid = valid;
+		query->hits_alloc = alloc;
+	}
+
+	query->strs[query->matched] = dex_arena_alloc(query->arena, hit->len + 1);
+	if (query->strs[query->matched] == NULL) {
+		query->failed = 1;
+		return;
+	}
+	memcpy(query->strs[query->matched], hit->str, hit->len + 1);
+	query->hits[query->matched] = hit->string_idx;
+	query->valid[query->matched] = hit->valid;
+	query->matched++;
+}
+
+static void addStringRef(const dex_image *dex, u4 string_idx, u4 class_def_idx, void *ctx)
+{
+	strings_query *query = ctx;
+	string_ref *refs;
+	u4 alloc;
+
+	if (query->failed)
+		return;
+	if (query->refs_size == query->refs_alloc) {
+		alloc = query->refs_alloc ? query->refs_alloc * 2 : 64;
+		refs = dex_arena_grow(query->arena, query->refs, query->refs_alloc * sizeof(string_ref), alloc * sizeof(string_ref));
+		if (refs == NULL) {
+			query->failed = 1;
+			return;
 		}
+		query->refs = refs;
+		query->refs_alloc = alloc;
+	}
 
-		if (DEBUG) psprintf ("\t%d instance fields\n", instance_fields_size);
+	query->refs[query->refs_size].string_idx = string_idx;
+	query->refs[query->refs_size].class_def_idx = class_def_idx;
+	query->refs_size++;
+}
 
-		for (i=0;i<instance_fields_size;i++) {
-			field_idx_diff = readUnsignedLeb128(&buffer);
-			field_access_flags = readUnsignedLeb128(&buffer);
-			if (DEBUG) {
-				psprintf ("\t\t[%d]|--field_idx_diff='0x%x'\n", i,field_idx_diff);
-				//printTypeDesc(string_id_list,type_id_list,field_idx_diff,input,str,"%s\n");
-				psprintf ("\t\t    |--field_access_flags='0x%x' :",field_access_flags);
-				parseAccessFlags(field_access_flags);
-			}
+static int compareStringRefs(const void *a, const void *b)
+{
+	const string_ref *x = a, *y = b;
+
+	if (x->string_idx != y->string_idx)
+		return x->string_idx < y->string_idx ? -1 : 1;
+	return (x->class_def_idx > y->class_def_idx) - (x->class_def_idx < y->class_def_idx);
+}
+
+/* -g: the strings matching any of the patterns, with -V the classes using them */
+static int queryStrings(const dex_image *dex, const dexinfo_options *opts)
+{
+	dex_matcher matcher;
+	strings_query query;
+	const char *desc;
+	u1 *wanted;
+	u4 i, r = 0, class_def_idx;
+
+	if (dex_matcher_build(dex, opts->type ? opts->type : "", &matcher) < 0) {
+		if (dex->arena->exceeded)
+			dex_alloc_error(dex->arena);
+		else
+			fprintf(stderr, "ERROR: no pattern to look for\n");
+		return -1;
+	}
+	/* stopped by the budget, dexinfo() says so */
+	if (dex->budget && dex->budget->status)
+		return 0;
+
+	memset(&query, 0, sizeof(query));
+	query.opts = opts;
+	query.arena = dex->arena;
+
+	if (dex_strings_scan(dex, &matcher, printStringHit, &query) < 0 || query.failed) {
+		dex_alloc_error(dex->arena);
+		return -1;
+	}
+
+	if (opts->verbose && query.matched) {
+		/* one walk over the code and static values for all of them */
+		wanted = dex_arena_calloc(dex->arena, *dex->header->string_ids_size, 1);
+		if (wanted == NULL) {
+			dex_alloc_error(dex->arena);
+			return -1;
+		}
+		for (i = 0; i < query.matched; i++)
+			wanted[query.hits[i]] = 1;
+		if (dex_string_refs(dex, wanted, opts->class_filter, addStringRef, &query) < 0 || query.failed) {
+			dex_alloc_error(dex->arena);
+			return -1;
 		}
+		qsort(query.refs, query.refs_size, sizeof(string_ref), compareStringRefs);
+	}
 
-		if (!DEBUG) psprintf ("%d direct methods, %d virtual methods\n", direct_methods_size, virtual_methods_size);
-
-
-		if (DEBUG) psprintf ("\t%d direct methods\n", direct_methods_size);
-
-		key=0;
-		for (i=0;i<direct_methods_size;i++) {
-			method_idx_diff = readUnsignedLeb128(&buffer);
-			method_access_flags = readUnsignedLeb128(&buffer);
-			method_code_off = readUnsignedLeb128(&buffer);
-
-			/* methods */
-			if (key == 0) key=method_idx_diff;
-			else key += method_idx_diff;
-
-			u2 class_idx=*method_id_list[key].class_idx;
-			u2 proto_idx=*method_id_list[key].proto_idx;
-			u4 name_idx=*method_id_list[key].name_idx;
-
-			/* print method name ... should really do this stuff through a common function, its going to be annoying to debug this...:/ */
-			offset2=*string_id_list[name_idx].string_data_off;
-			psseek(input, offset2, SEEK_SET);
-
-			buf = malloc(10 * sizeof(u1));
-			psread(buf, 1, sizeof(buf), input);
-			size_uleb_value = uleb128_value(buf);
-			size_uleb=len_uleb128(size_uleb_value);
-			str = malloc(size_uleb_value * sizeof(u1)+1);
-			// offset2: on esta el tamany (size_uleb_value) en uleb32 de la string, seguit de la string
-			psseek(input, offset2+size_uleb, SEEK_SET);
-			psread(str, 1, size_uleb_value, input);
-			str[size_uleb_value]='\0';
-
-			psprintf ("\tdirect method %d = %s\n",i+1, str);
-			free(str);
-			str=NULL;
-			if (DEBUG) {
-				psprintf("\t\tmethod_code_off=0x%x\n", method_code_off);
-				psprintf("\t\tmethod_access_flags='0x%x'\n", method_access_flags);
-				//parseAccessFlags(method_access_flags);	
-				psprintf("\t\tclass_idx='0x%x'\n", class_idx);
-				//printTypeDesc(string_id_list,type_id_list,class_idx,input,str," %s\n");
-				psprintf("\t\tproto_idx=0x%x\n", proto_idx);
-			}
+	/* hits come in string_idx order, and so do the references once sorted */
+	for (i = 0; opts->verbose && i < query.matched; i++) {
+		printString(query.hits[i], query.strs[i], query.valid[i]);
+		for (; r < query.refs_size && query.refs[r].string_idx <= query.hits[i]; r++) {
+			class_def_idx = query.refs[r].class_def_idx;
+			desc = dex_type_desc(dex, *dex->class_defs[class_def_idx].class_idx);
+			psprintf("\t\tClass %u %s\n", class_def_idx + 1, desc ? desc : "(invalid)");
 		}
+	}
 
-		if (DEBUG) psprintf ("\t%d virtual methods\n", virtual_methods_size);
-
-		key=0;
-		for (i=0;i<virtual_methods_size;i++) {
-			method_idx_diff = readUnsignedLeb128(&buffer);
-			method_access_flags = readUnsignedLeb128(&buffer);
-			method_code_off = readUnsignedLeb128(&buffer);
-
-			/* methods */
-			if (key == 0) key=method_idx_diff;
-			else key += method_idx_diff;
-
-			u2 class_idx=*method_id_list[key].class_idx;
-			u2 proto_idx=*method_id_list[key].proto_idx;
-			u4 name_idx=*method_id_list[key].name_idx;
-			
-			/* print method name */
-			offset2=*string_id_list[name_idx].string_data_off;
-			//printStringValue(string_id_list,name_idx,input,str,"%s\n");
-			psseek(input, offset2, SEEK_SET);
-
-			buf = malloc(10 * sizeof(u1));
-			psread(buf, 1, sizeof(buf), input);
-			size_uleb_value = uleb128_value(buf);
-			size_uleb=len_uleb128(size_uleb_value);
-			str = malloc(size_uleb_value * sizeof(u1)+1);
-			// offset2: on esta el tamany (size_uleb_value) en uleb32 de la string, seguit de la string 
-			psseek(input, offset2+size_uleb, SEEK_SET);
-			psread(str, 1, size_uleb_value, input);
-			str[size_uleb_value]='\0';
-
-			psprintf ("\tvirtual method %d = %s\n",i+1, str);
-			free(str);
-			str=NULL;
-			if (DEBUG) {
-				psprintf("\t\tmethod_code_off=0x%x\n", method_code_off);
-				psprintf("\t\tmethod_access_flags='0x%x'\n", method_access_flags);
-				//parseAccessFlags(method_access_flags);	
-				psprintf("\t\tclass_idx=0x%x\n", class_idx);
-				psprintf("\t\tproto_idx=0x%x\n", proto_idx);
-			}
+	if (dex->budget == NULL || dex->budget->status == DEX_BUDGET_OK)
+		psprintf("[] Total: %u matching strings of %u\n", query.matched, *dex->header->string_ids_size);
+	return 0;
+}
+
+static dex_symbols *symbol_table = NULL;
+
+/* the table every parse of this process interns into, opened with -G or by the server */
+void dexinfo_use_symbols(dex_symbols *symbols)
+{
+	symbol_table = symbols;
+}
+
+/* -f applies to the class a type is, or a member belongs to */
+static int symbolFiltered(const dex_image *dex, const dexinfo_options *opts, u4 type_idx)
+{
+	const char *desc;
+
+	if (opts->class_filter == NULL)
+		return 0;
+	desc = dex_type_desc(dex, type_idx);
+	return desc == NULL || fnmatch(opts->class_filter, desc, 0) != 0;
+}
+
+/*
+ * -i: every type, field and method reference of the dex with the ids of
+ * the shared symbol table, the same in every dex interned into that table.
+ * A field is class:name:type, a method class:name:proto.
+ */
+static int querySymbols(const dex_image *dex, const dexinfo_options *opts)
+{
+	dex_symbol_map map;
+	u4 i, class_id, name_id, type_id, types = 0, fields = 0, methods = 0;
+	const char *desc;
+
+	if (symbol_table == NULL && (symbol_table = dex_symbols_open(NULL)) == NULL) {
+		fprintf(stderr, "ERROR: cannot map the symbol table: %s\n", strerror(errno));
+		return -1;
+	}
+	if (dex_symbol_map_init(dex, symbol_table, &map) < 0) {
+		dex_alloc_error(dex->arena);
+		return -1;
+	}
+
+	for (i = 0; i < *dex->header->type_ids_size; i++) {
+		if (dex_budget_spend(dex, 1))
+			return 0;
+		if (symbolFiltered(dex, opts, i))
+			continue;
+		if ((type_id = dex_type_symbol(&map, i)) == 0)
+			goto full;
+		desc = dex_type_desc(dex, i);
+		psprintf("[] Type %u %s\n", type_id, desc ? desc : "(invalid)");
+		types++;
+	}
+
+	for (i = 0; i < *dex->header->field_ids_size; i++) {
+		if (dex_budget_spend(dex, 1))
+			return 0;
+		if (symbolFiltered(dex, opts, *dex->field_ids[i].class_idx))
+			continue;
+		class_id = dex_type_symbol(&map, *dex->field_ids[i].class_idx);
+		name_id = dex_string_symbol(&map, *dex->field_ids[i].name_idx);
+		type_id = dex_type_symbol(&map, *dex->field_ids[i].type_idx);
+		if (class_id == 0 || name_id == 0 || type_id == 0)
+			goto full;
+		desc = dex_type_desc(dex, *dex->field_ids[i].class_idx);
+		psprintf("[] Field %u:%u:%u %s->", class_id, name_id, type_id, desc ? desc : "(invalid)");
+		printMemberSignature(dex, DEX_DIFF_FIELD, i);
+		psprintf("\n");
+		fields++;
+	}
+
+	for (i = 0; i < *dex->header->method_ids_size; i++) {
+		if (dex_budget_spend(dex, 1))
+			return 0;
+		if (symbolFiltered(dex, opts, *dex->method_ids[i].class_idx))
+			continue;
+		class_id = dex_type_symbol(&map, *dex->method_ids[i].class_idx);
+		name_id = dex_string_symbol(&map, *dex->method_ids[i].name_idx);
+		type_id = dex_proto_symbol(&map, *dex->method_ids[i].proto_idx);
+		if (class_id == 0 || name_id == 0 || type_id == 0)
+			goto full;
+		desc = dex_type_desc(dex, *dex->method_ids[i].class_idx);
+		psprintf("[] Method %u:%u:%u %s->", class_id, name_id, type_id, desc ? desc : "(invalid)");
+		printMemberSignature(dex, DEX_DIFF_METHOD, i);
+		psprintf("\n");
+		methods++;
+	}
+
+	psprintf("[] Total: %u types, %u fields, %u methods, %u symbols in the table\n",
+		types, fields, methods, dex_symbols_count(symbol_table));
+	return 0;
+
+full:
+	/* invalid indexes intern nothing either, but the table is the likely cause */
+	if (dex->arena->exceeded)
+		dex_alloc_error(dex->arena);
+	else
+		fprintf(stderr, "ERROR: the symbol table is full\n");
+	return -1;
+}
+
+#ifndef PYDEXINFO
+static dex_cache *image_cache = NULL;
+static int serving = 0;
+static int last_status = 0;
+
+/*
+ * The server keeps images and their indexes between requests, cache is
+ * NULL when it could not set one up. Either way dexinfo() now returns on
+ * errors instead of exiting, see dexinfo_status().
+ */
+void dexinfo_use_cache(dex_cache *cache)
+{
+	image_cache = cache;
+	serving = 1;
+}
+
+/* what the command line tool would have exited with after the last dexinfo() */
+int dexinfo_status(void)
+{
+	return last_status;
+}
+#endif
+
+/* 1 for an error, 2 for a cancelled parse, 3 for an exceeded budget */
+static char * parseFailed(int status)
+{
+#ifndef PYDEXINFO
+	if (!serving)
+		exit(status);
+	last_status = status;
+#endif
+	return NULL;
+}
+
+void parseClass(){
+
+}
+void parseHeader(){
+
+}
+void help_show_message()
+{
+	fprintf(stderr, "Usage: dexinfo <file.dex> [options]\n");
+	fprintf(stderr, " options:\n");
+	fprintf(stderr, "    -V             print verbose information\n");
+	fprintf(stderr, "    -H             print the dex header only\n");
+	fprintf(stderr, "    -c             print field and method counts per class only\n");
+	fprintf(stderr, "    -n             print class names only\n");
+	fprintf(stderr, "    -l             print the source line table and local variables of every method\n");
+	fprintf(stderr, "    -f <pattern>   only process classes whose descriptor matches pattern\n");
+	fprintf(stderr, "    -a <type>      list classes, fields, methods and parameters annotated with type\n");
+	fprintf(stderr, "    -s             print the initial values of static fields only\n");
+	fprintf(stderr, "    -F             print rename-proof bytecode fingerprints of methods and classes\n");
+	fprintf(stderr, "    -S <types>     list all subclasses of the comma separated types\n");
+	fprintf(stderr, "    -I <types>     list all classes implementing or extending the types\n");
+	fprintf(stderr, "    -A <types>     print the superclass chain of the types\n");
+	fprintf(stderr, "    -D <file.dex>  list classes and members changed in another dex file\n");
+	fprintf(stderr, "    -E <file>      write the class, field and method tables as columns to file\n");
+	fprintf(stderr, "    -g <patterns>  list the strings matching any of the comma separated patterns\n");
+	fprintf(stderr, "    -i             print type, field and method references with corpus-wide symbol ids\n");
+	fprintf(stderr, "    -M <size>      fail when a parse needs more than size bytes (k, m, g suffixes)\n");
+	fprintf(stderr, "    -T <time>      stop with a partial result after time (ms, s, m suffixes, seconds by default)\n");
+	fprintf(stderr, "    -N <items>     stop with a partial result after that many classes, fields and methods\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "    -G <file>      intern symbols into the table in file, shared by every run using it\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "       dexinfo -L <socket> [-W <workers>] [-G <file>]\n");
+	fprintf(stderr, "    -L <socket>    serve requests on a unix socket, see README.md\n");
+	fprintf(stderr, "    -W <workers>   number of worker processes, one per cpu by default\n");
+}
+
+/* state of the text output, shared by the visitors of every projection */
+typedef struct {
+	const dexinfo_options *opts;
+	const char *dexfile;
+	const char *desc;		/* descriptor of the current class, when it was resolved */
+	u4 annotation_type_idx;
+	u4 last_idx;			/* previous entry of the list, for the _idx_diff lines */
+	u8 total_classes;
+	u8 total_fields;
+	u8 total_methods;
+	dex_debug *debug;		/* -l */
+	u8 total_positions;
+	u8 total_locals;
+	dex_fingerprint *fingerprint;	/* -F */
+	u8 class_fingerprint;
+	u4 class_methods;
+	int failed;
+} text_output;
+
+/* header information, -1 when this is not a dex file */
+static int printHeader(const dex_image *dex, void *ctx)
+{
+	text_output *out = ctx;
+	const dex_header *header = dex->header;
+	int DEBUG = out->opts->verbose;
+	int i;
+
+	/* print dex header information */
+        psprintf ("[] Dex file: %s\n\n",out->dexfile);
+
+	psprintf ("[] DEX magic: ");
+	for (i=0;i<3;i++) psprintf("%02X ", header->magic.dex[i]);
+	psprintf("%02X ", *header->magic.newline);
+	for (i=0;i<3;i++) psprintf("%02X ", header->magic.ver[i]);
+	psprintf("%02X ", *header->magic.zero);
+	psprintf ("\n");
+
+	if ( (strncmp(header->magic.dex,"dex",3) != 0) || 
+	     (strncmp(header->magic.newline,"\n",1) != 0) || 
+	     (strncmp(header->magic.zero,"\0",1) != 0 ) ) {
+		fprintf (stderr, "ERROR: not a dex file\n");
+		return -1;
+	}
+
+	psprintf ("[] DEX version: %s\n", header->magic.ver);
+	if (strncmp(header->magic.ver,"035",3) != 0) {
+		fprintf (stderr,"Warning: Dex file version != 035\n");
+	}
+
+	psprintf ("[] Adler32 checksum: 0x%x\n", *header->checksum);
+
+	psprintf ("[] SHA1 signature: ");
+	for (i=0;i<20;i++) psprintf("%02x", header->signature[i]);
+	psprintf("\n");
+
+	if (DEBUG) {
+		psprintf ("[] File size: %d bytes\n", *header->file_size);
+		psprintf ("[] DEX Header size: %d bytes (0x%x)\n", *header->header_size, *header->header_size);
+	}
+
+	if (*header->header_size != 0x70) {
+		fprintf (stderr,"Warning: Header size != 0x70\n");
+	}
+
+	if (DEBUG) psprintf("[] Endian Tag: 0x%x\n", *header->endian_tag);
+	if (*header->endian_tag != 0x12345678) {
+		fprintf (stderr,"Warning: Endian tag != 0x12345678\n");
+	}
+
+	if (DEBUG) {
+		psprintf("[] Link size: %d\n", *header->link_size);
+		psprintf("[] Link offset: 0x%x\n", *header->link_off);
+		psprintf("[] Map list offset: 0x%x\n", *header->map_off);
+		psprintf("[] Number of strings in string ID list: %d\n", *header->string_ids_size);
+		psprintf("[] String ID list offset: 0x%x\n", *header->string_ids_off);
+		psprintf("[] Number of types in the type ID list: %d\n", *header->type_ids_size);
+		psprintf("[] Type ID list offset: 0x%x\n", *header->type_ids_off);
+		psprintf("[] Number of items in the method prototype ID list: %d\n", *header->proto_ids_size);
+		psprintf("[] Method prototype ID list offset: 0x%x\n", *header->proto_ids_off);
+		psprintf("[] Number of item in the field ID list: %d\n", *header->field_ids_size);
+		psprintf("[] Field ID list offset: 0x%x\n", *header->field_ids_off);
+		psprintf("[] Number of items in the method ID list: %d\n", *header->method_ids_size);
+		psprintf("[] Method ID list offset: 0x%x\n", *header->method_ids_off);
+		psprintf("[] Number of items in the class definitions list: %d\n", *header->class_defs_size);
+		psprintf("[] Class definitions list offset: 0x%x\n", *header->class_defs_off);
+		psprintf("[] Data section size: %d bytes\n", *header->data_size);
+		psprintf("[] Data section offset: 0x%x\n", *header->data_off);
+	}
 
+	if (out->opts->mode != DEXINFO_MODE_HEADER)
+		psprintf("\n[] Number of classes in the archive: %d\n", *header->class_defs_size);
+
+	return 0;
+}
+
+static int printFullHeader(const dex_image *dex, void *ctx)
+{
+	int ret = printHeader(dex, ctx);
+
+#if 0
+	/* strings */
+	for (i=0;i < (int)*dex->header->string_ids_size;i++) {
+		 psprintf("string_id_list[%d] (%x) = \n", i, *dex->string_ids[i].string_data_off);
+	}
+#endif
+#ifdef PYDEXINFO
+	u4 i;
+
+	/* methods */
+	for (i=0;ret == 0 && i<*dex->header->method_ids_size;i++) {
+		// psprintf ("method_id_list[%d]class=%x\n", i, *dex->method_ids[i].class_idx);
+		// psprintf ("method_id_list[%d]proto=%x\n", i, *dex->method_ids[i].proto_idx);
+		// psprintf ("method_id_list[%d]name=%x\n", i, *dex->method_ids[i].name_idx);
+		printStringValue(dex, *dex->method_ids[i].name_idx, "MethodVal %s\n");
+	}
+#endif
+
+	return ret;
+}
+
+/* the annotation type is resolved once, classes are then matched by index */
+static int printAnnotationsHeader(const dex_image *dex, void *ctx)
+{
+	text_output *out = ctx;
+	const char *type = out->opts->type;
+	int ret = printHeader(dex, ctx);
+
+	if (ret)
+		return ret;
+
+	out->annotation_type_idx = type ? dex_find_type(dex, type) : NO_INDEX;
+	if (out->annotation_type_idx == NO_INDEX) {
+		psprintf("[] Annotation %s is not used in this dex\n", type ? type : "(none)");
+		return 1;
+	}
+	psprintf("[] Annotation %s (type_idx=0x%x)\n", type, out->annotation_type_idx);
+
+	return 0;
+}
+
+/* -f, the descriptor is only resolved when something needs it */
+static int skipClass(const dex_image *dex, const dex_class *cls, text_output *out, int need_desc)
+{
+	const char *filter = out->opts->class_filter;
+
+	out->desc = NULL;
+	if (filter || need_desc) {
+		out->desc = dex_type_desc(dex, *cls->class_def->class_idx);
+		if (filter && (out->desc == NULL || fnmatch(filter, out->desc, 0) != 0))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int printClassName(const dex_image *dex, const dex_class *cls, void *ctx)
+{
+	text_output *out = ctx;
+
+	if (skipClass(dex, cls, out, 1))
+		return 1;
+
+	out->total_classes++;
+	psprintf("[] Class %u %s\n", cls->class_def_idx + 1, out->desc ? out->desc : "(invalid)");
+	return 1;
+}
+
+/* the counts sit at the start of class_data_item, nothing else is decoded */
+static int printClassCounts(const dex_image *dex, const dex_class *cls, void *ctx)
+{
+	text_output *out = ctx;
+
+	if (skipClass(dex, cls, out, 0))
+		return 1;
+
+	out->total_classes++;
+	out->total_fields += cls->counts[DEX_STATIC_FIELDS] + cls->counts[DEX_INSTANCE_FIELDS];
+	out->total_methods += cls->counts[DEX_DIRECT_METHODS] + cls->counts[DEX_VIRTUAL_METHODS];
+
+	psprintf ("[] Class %u: %u static fields, %u instance fields, %u direct methods, %u virtual methods\n",
+		cls->class_def_idx + 1, cls->counts[DEX_STATIC_FIELDS], cls->counts[DEX_INSTANCE_FIELDS],
+		cls->counts[DEX_DIRECT_METHODS], cls->counts[DEX_VIRTUAL_METHODS]);
+	return 1;
+}
+
+static int printClassAnnotations(const dex_image *dex, const dex_class *cls, void *ctx)
+{
+	text_output *out = ctx;
+	int hits;
+
+	if (skipClass(dex, cls, out, 0))
+		return 1;
+
+	hits = dex_annotations_walk(dex, cls->class_def_idx, out->annotation_type_idx, printAnnotationMatch, NULL);
+	if (hits) {
+		out->total_classes++;
+		out->total_methods += hits;
+	}
+	return 1;
+}
+
+/* only classes with an encoded_array_item have initial values */
+static int beginStatics(const dex_image *dex, const dex_class *cls, void *ctx)
+{
+	text_output *out = ctx;
+
+	if (*cls->class_def->static_values_off == 0 || *cls->class_def->class_data_off == 0 ||
+	    skipClass(dex, cls, out, 1))
+		return 1;
+
+	out->total_classes++;
+	return 0;
+}
+
+static int staticsMembers(const dex_image *dex, const dex_class *cls, int kind, void *ctx)
+{
+	return kind != DEX_STATIC_FIELDS;
+}
+
+static void printStaticValue(const dex_image *dex, const dex_class *cls, const dex_field *field, void *ctx)
+{
+	text_output *out = ctx;
+	const char *str;
+
+	if (field->value == NULL)
+		return;
+
+	str = field->field_idx < *dex->header->field_ids_size ? dex_string(dex, *dex->field_ids[field->field_idx].name_idx) : NULL;
+	psprintf ("[] Class %u %s: %s = ", cls->class_def_idx + 1, out->desc ? out->desc : "(invalid)", str ? str : "(invalid)");
+	printValue(dex, field->value);
+	psprintf ("\n");
+	out->total_fields++;
+}
+
+static void printClassTitle(const dex_image *dex, const dex_class *cls)
+{
+	psprintf("[] Class %u ", cls->class_def_idx + 1);
+	/* print class filename */
+	if (*cls->class_def->source_file_idx != 0xffffffff) {
+		printClassFileName(dex,cls->class_def);
+	} else {
+		psprintf ("(No index): ");
+	}
+}
+
+static int beginClass(const dex_image *dex, const dex_class *cls, void *ctx)
+{
+	text_output *out = ctx;
+
+	if (skipClass(dex, cls, out, 0))
+		return 1;
+
+	out->total_classes++;
+	printClassTitle(dex, cls);
+	psprintf ("%u direct methods, %u virtual methods\n", cls->counts[DEX_DIRECT_METHODS], cls->counts[DEX_VIRTUAL_METHODS]);
+	return 0;
+}
+
+static void printMethod(const dex_image *dex, const dex_class *cls, const dex_method *method, void *ctx)
+{
+	const char *kind = method->kind == DEX_DIRECT_METHODS ? "direct" : "virtual";
+	const char *str = NULL;
+
+	/* print method name, straight from the string data in the image */
+	if (method->method_idx < *dex->header->method_ids_size)
+		str = dex_string(dex, *dex->method_ids[method->method_idx].name_idx);
+
+	psprintf ("\t%s method %u = %s\n", kind, method->position + 1, str ? str : "(invalid)");
+}
+
+static int beginClassVerbose(const dex_image *dex, const dex_class *cls, void *ctx)
+{
+	text_output *out = ctx;
+	const class_def_struct *class_def_item = cls->class_def;
+	const u2 *interfaces;
+	const char *str;
+	u4 i, interfaces_size;
+
+	if (skipClass(dex, cls, out, 0))
+		return 1;
+
+	out->total_classes++;
+	printClassTitle(dex, cls);
+
+	psprintf("\n");
+	/* print type id */
+	psprintf("\tclass_idx='0x%x':", *class_def_item->class_idx);
+	printTypeDescForClass(dex,class_def_item);
+	psprintf("\taccess_flags='0x%x':", *class_def_item->access_flags); /*need to interpret this*/
+	parseAccessFlags(*class_def_item->access_flags);
+	psprintf("\tsuperclass_idx='0x%x':", *class_def_item->superclass_idx);
+	printTypeDesc(dex,*class_def_item->superclass_idx,"%s\n");
+	psprintf("\tinterfaces_off='0x%x'\n", *class_def_item->interfaces_off);
+	interfaces = dex_type_list(dex, *class_def_item->interfaces_off, &interfaces_size);
+	for (i=0;i<interfaces_size;i++) {
+		str = dex_type_desc(dex, interfaces[i]);
+		psprintf("\t\tinterface %s\n", str ? str : "(invalid)");
+	}
+	psprintf("\tsource_file_idx='0x%x'\n", *class_def_item->source_file_idx);
+	if (*class_def_item->source_file_idx != NO_INDEX) 
+		printStringValue(dex,*class_def_item->source_file_idx,"%s\n");
+	psprintf("\tannotations_off=0x%x\n", *class_def_item->annotations_off);
+	dex_annotations_walk(dex, cls->class_def_idx, NO_INDEX, printAnnotation, NULL);
+	psprintf("\tclass_data_off=0x%x (%d)\n", *class_def_item->class_data_off, *class_def_item->class_data_off);
+	psprintf("\tstatic_values_off=0x%x (%d)\n", *class_def_item->static_values_off, *class_def_item->static_values_off);
+
+	if (*class_def_item->class_data_off == 0) {
+		psprintf ("\t0 static fields\n");
+		psprintf ("\t0 instance fields\n");
+		psprintf ("\t0 direct methods\n");
+	}
+
+	return 0;
+}
+
+static int printMembersVerbose(const dex_image *dex, const dex_class *cls, int kind, void *ctx)
+{
+	static const char *names[] = { "static fields", "instance fields", "direct methods", "virtual methods" };
+	text_output *out = ctx;
+
+	out->last_idx = 0;
+	psprintf ("\t%u %s\n", cls->counts[kind], names[kind]);
+	return 0;
+}
+
+static void printFieldVerbose(const dex_image *dex, const dex_class *cls, const dex_field *field, void *ctx)
+{
+	text_output *out = ctx;
+	u4 field_idx_diff = field->field_idx - out->last_idx;
+
+	out->last_idx = field->field_idx;
+
+	psprintf ("\t\t[%d]|--field_idx_diff='0x%x'\n", field->position, field_idx_diff);
+	if (field->kind == DEX_STATIC_FIELDS) {
+		psprintf ("\t\t    |--field_access_flags='0x%x'", field->access_flags);
+		parseAccessFlags(field->access_flags);
+		if (field->value) {
+			psprintf ("\t\t    |--static_value=");
+			printValue(dex, field->value);
+			psprintf ("\n");
+		}
+	} else {
+		psprintf ("\t\t    |--field_access_flags='0x%x' :", field->access_flags);
+		parseAccessFlags(field->access_flags);
+	}
+}
+
+static void printMethodVerbose(const dex_image *dex, const dex_class *cls, const dex_method *method, void *ctx)
+{
+	const method_id_struct *method_id;
+
+	printMethod(dex, cls, method, ctx);
+	if (method->method_idx >= *dex->header->method_ids_size)
+		return;
+
+	method_id = &dex->method_ids[method->method_idx];
+	psprintf("\t\tmethod_code_off=0x%x\n", method->code_off);
+	psprintf("\t\tmethod_access_flags='0x%x'\n", method->access_flags);
+	//parseAccessFlags(method_access_flags);
+	if (method->kind == DEX_DIRECT_METHODS) {
+		psprintf("\t\tclass_idx='0x%x'\n", *method_id->class_idx);
+	} else {
+		psprintf("\t\tclass_idx=0x%x\n", *method_id->class_idx);
+	}
+	psprintf("\t\tproto_idx=0x%x\n", *method_id->proto_idx);
+}
+
+/* -l: the debug information is only decoded for the methods that get printed */
+static int beginLines(const dex_image *dex, const dex_class *cls, void *ctx)
+{
+	text_output *out = ctx;
+
+	if (out->debug->failed || skipClass(dex, cls, out, 1))
+		return 1;
+
+	out->total_classes++;
+	psprintf("[] Class %u %s\n", cls->class_def_idx + 1, out->desc ? out->desc : "(invalid)");
+	return 0;
+}
+
+static void printDebugString(const dex_image *dex, u4 string_idx)
+{
+	const char *str = dex_string(dex, string_idx);
+
+	psprintf(" %s", str ? str : "(invalid)");
+}
+
+static void printMethodLines(const dex_image *dex, const dex_class *cls, const dex_method *method, void *ctx)
+{
+	text_output *out = ctx;
+	const dex_debug_info *info;
+	const dex_debug_local *local;
+	const char *str;
+	u4 i;
+
+	printMethod(dex, cls, method, ctx);
+
+	info = dex_debug_get(out->debug, method->method_idx, method->access_flags, method->code_off);
+	if (info == NULL)
+		return;
+
+	out->total_methods++;
+	out->total_positions += info->positions_size;
+	out->total_locals += info->locals_size;
+
+	if (info->file_idx != NO_INDEX) {
+		psprintf("\t\tsource_file");
+		printDebugString(dex, info->file_idx);
+		psprintf("\n");
+	}
+	for (i = 0; i < info->positions_size; i++)
+		psprintf("\t\t0x%04x line=%u\n", info->positions[i].address, info->positions[i].line);
+	for (i = 0; i < info->locals_size; i++) {
+		local = &info->locals[i];
+		psprintf("\t\t0x%04x - 0x%04x v%u", local->start, local->end, local->reg);
+		if (local->flags & DEX_DEBUG_THIS) {
+			psprintf(" this");
+		} else {
+			printDebugString(dex, local->name_idx);
 		}
+		if (local->type_idx != NO_INDEX) {
+			str = dex_type_desc(dex, local->type_idx);
+			psprintf(" %s", str ? str : "(invalid)");
+		}
+		if (local->signature_idx != NO_INDEX)
+			printDebugString(dex, local->signature_idx);
+		psprintf("\n");
+	}
+}
+
+/* -F: one line per method with code, then one for its class */
+static int beginFingerprints(const dex_image *dex, const dex_class *cls, void *ctx)
+{
+	text_output *out = ctx;
+
+	if (out->failed || skipClass(dex, cls, out, 1))
+		return 1;
+
+	out->class_fingerprint = 0;
+	out->class_methods = 0;
+	return 0;
+}
+
+static void printMethodFingerprint(const dex_image *dex, const dex_class *cls, const dex_method *method, void *ctx)
+{
+	text_output *out = ctx;
+	const code_item_struct *code = dex_code_item(dex, method->code_off);
+	u8 fp;
 
-		free(buffer_pos);
+	if (code == NULL || out->failed)
+		return;
+
+	fp = dex_method_fingerprint(out->fingerprint, code);
+	if (fp == 0) {
+		out->failed = 1;
+		return;
 	}
 
-	free(type_id_list);
-	free(method_id_list);
-	free(string_id_list);
+	out->class_fingerprint = dex_class_fingerprint(out->class_fingerprint, fp);
+	out->class_methods++;
+	out->total_methods++;
+
+	psprintf("[] Method %016llx %s->", (unsigned long long)fp, out->desc ? out->desc : "(invalid)");
+	printMemberSignature(dex, DEX_DIFF_METHOD, method->method_idx);
+	psprintf("\n");
+}
+
+static void printClassFingerprint(const dex_image *dex, const dex_class *cls, void *ctx)
+{
+	text_output *out = ctx;
+
+	/* classes without code have nothing to match on */
+	if (out->class_methods == 0 || out->failed)
+		return;
+
+	out->total_classes++;
+	psprintf("[] Class %016llx %s (%u methods)\n", (unsigned long long)out->class_fingerprint,
+		out->desc ? out->desc : "(invalid)", out->class_methods);
+}
+
+/* the text output of each projection is one visitor */
+static const dex_visitor header_visitor = { printHeader };
+static const dex_visitor classes_visitor = { printHeader, printClassName };
+static const dex_visitor counts_visitor = { printHeader, printClassCounts, .flags = DEX_VISIT_COUNTS };
+static const dex_visitor annotations_visitor = { printAnnotationsHeader, printClassAnnotations };
+static const dex_visitor statics_visitor = {
+	printHeader, beginStatics, staticsMembers, printStaticValue, .flags = DEX_VISIT_STATIC_VALUES
+};
+static const dex_visitor full_visitor = { printFullHeader, beginClass, .method = printMethod };
+static const dex_visitor lines_visitor = { printHeader, beginLines, .method = printMethodLines };
+static const dex_visitor fingerprints_visitor = {
+	printHeader, beginFingerprints, .method = printMethodFingerprint, .class_end = printClassFingerprint
+};
+static const dex_visitor verbose_visitor = {
+	printFullHeader, beginClassVerbose, printMembersVerbose, printFieldVerbose, printMethodVerbose,
+	.flags = DEX_VISIT_STATIC_VALUES
+};
+
+char * dexinfo(char * dexfile, const dexinfo_options * opts)
+{
+	const dex_visitor *visitor;
+	text_output out;
+	int ret, failed = 0;
+
+	dex_arena arena;
+	dex_budget budget;
+	dex_image dex;
+	dex_hierarchy *hierarchy = NULL;
+	dex_debug debug, *cached_debug = NULL;
+	dex_fingerprint fingerprint;
+#ifndef PYDEXINFO
+	dex_cache_entry *cached = NULL;
+#endif
+
+#ifdef PYDEXINFO
+	if (!printbuf)
+	{
+	}
+	else
+	{
+		free(printbuf);
+		printbuf = NULL;
+		printbuf_len = 0;
+		printbuf_alloc = 0;
+	}
+#endif
+
+#ifndef PYDEXINFO
+	last_status = 0;
+#endif
+
+	/* everything the parse allocates is released in one go at the end */
+	dex_arena_init(&arena, opts->memory_limit);
+
+	psprintf ("\n=== dexinfo %s - (c) 2012-2013 Pau Oliva Fora\n\n", VERSION);
+
+#ifndef PYDEXINFO
+	/* a capped parse builds everything in its own arena, it can't use the cache */
+	if (image_cache && opts->mode != DEXINFO_MODE_HEADER && opts->memory_limit == 0)
+		cached = dex_cache_get(image_cache, dexfile);
+	if (cached) {
+		dex = cached->dex;
+		dex.borrowed = 1;
+		dex.arena = &arena;
+		if (opts->mode == DEXINFO_MODE_SUBCLASSES || opts->mode == DEXINFO_MODE_IMPLEMENTORS ||
+		    opts->mode == DEXINFO_MODE_ANCESTORS)
+			hierarchy = dex_cache_hierarchy(cached);
+		if (opts->mode == DEXINFO_MODE_LINES)
+			cached_debug = dex_cache_debug(cached);
+	} else
+#endif
+	if (dex_load(&dex, dexfile, opts->mode == DEXINFO_MODE_HEADER, &arena) < 0) {
+		dex_arena_release(&arena);
+		return parseFailed(1);
+	}
+
+	/* the clock starts once the image is there */
+	dex_budget_init(&budget, opts->time_limit, opts->item_limit, opts->cancel);
+	if (opts->time_limit || opts->item_limit || opts->cancel)
+		dex.budget = &budget;
+#ifndef PYDEXINFO
+	/* debug information decoded into the cache counts against this parse too */
+	if (cached)
+		cached->dex.budget = dex.budget;
+#endif
+
+	memset(&out, 0, sizeof(out));
+	out.opts = opts;
+	out.dexfile = dexfile;
+	if (cached_debug == NULL)
+		dex_debug_init(&dex, &debug);
+	out.debug = cached_debug ? cached_debug : &debug;
+
+	switch (opts->mode) {
+	case DEXINFO_MODE_FULL:
+		visitor = opts->verbose ? &verbose_visitor : &full_visitor;
+		break;
+	case DEXINFO_MODE_COUNTS:
+		visitor = &counts_visitor;
+		break;
+	case DEXINFO_MODE_CLASSES:
+		visitor = &classes_visitor;
+		break;
+	case DEXINFO_MODE_ANNOTATIONS:
+		visitor = &annotations_visitor;
+		break;
+	case DEXINFO_MODE_STATICS:
+		visitor = &statics_visitor;
+		break;
+	case DEXINFO_MODE_LINES:
+		visitor = &lines_visitor;
+		break;
+	case DEXINFO_MODE_FINGERPRINTS:
+		visitor = &fingerprints_visitor;
+		out.fingerprint = &fingerprint;
+		out.failed = dex_fingerprint_init(&dex, &fingerprint) < 0;
+		break;
+	default:
+		/* the queries only print the header before doing their own walk */
+		visitor = &header_visitor;
+	}
+
+	ret = dex_visit(&dex, visitor, &out);
+	if (ret < 0) {
+#ifndef PYDEXINFO
+		if (cached)
+			cached->dex.budget = NULL;
+#endif
+		dex_unload(&dex);
+		dex_arena_release(&arena);
+		return parseFailed(1);
+	}
+	if (ret > 0)
+		goto done;
+
+	if (opts->mode == DEXINFO_MODE_SUBCLASSES || opts->mode == DEXINFO_MODE_IMPLEMENTORS ||
+	    opts->mode == DEXINFO_MODE_ANCESTORS)
+		failed = queryHierarchy(&dex, hierarchy, opts) < 0;
+
+	if (opts->mode == DEXINFO_MODE_DIFF)
+		failed = queryDiff(&dex, opts) < 0;
+
+	if (opts->mode == DEXINFO_MODE_EXPORT)
+		failed = queryExport(&dex, opts) < 0;
+
+	if (opts->mode == DEXINFO_MODE_STRINGS)
+		failed = queryStrings(&dex, opts) < 0;
+
+	if (opts->mode == DEXINFO_MODE_SYMBOLS)
+		failed = querySymbols(&dex, opts) < 0;
+
+	/* a walk stopped by the -M cap ran out of memory, like any other allocation */
+	if (dex.arena->exceeded && !failed) {
+		dex_alloc_error(dex.arena);
+		failed = 1;
+		goto done;
+	}
+
+	/* what was printed stands, the totals would not */
+	if (budget.status != DEX_BUDGET_OK && !failed) {
+		psprintf ("[] Partial result: %s after %llu items\n", dex_budget_reason(budget.status),
+			(unsigned long long)budget.items);
+		if (budget.status != DEX_BUDGET_CANCELLED)
+			fprintf(stderr, "ERROR: %s\n", dex_budget_reason(budget.status));
+		goto done;
+	}
+
+	if (opts->mode == DEXINFO_MODE_FINGERPRINTS) {
+		failed = out.failed;
+		if (failed)
+			dex_alloc_error(dex.arena);
+		else
+			psprintf ("[] Total: %llu methods in %llu classes\n",
+				(unsigned long long)out.total_methods, (unsigned long long)out.total_classes);
+	}
+
+	if (opts->mode == DEXINFO_MODE_LINES) {
+		failed = out.debug->failed;
+		if (failed)
+			dex_alloc_error(dex.arena);
+		else
+			psprintf ("[] Total: %llu positions, %llu locals in %llu methods with debug information\n",
+				(unsigned long long)out.total_positions, (unsigned long long)out.total_locals,
+				(unsigned long long)out.total_methods);
+	}
+
+	if (opts->mode == DEXINFO_MODE_ANNOTATIONS)
+		psprintf ("[] Total: %llu annotations in %llu classes\n",
+			(unsigned long long)out.total_methods, (unsigned long long)out.total_classes);
+
+	if (opts->mode == DEXINFO_MODE_STATICS)
+		psprintf ("[] Total: %llu static values in %llu classes\n",
+			(unsigned long long)out.total_fields, (unsigned long long)out.total_classes);
+
+	if (opts->mode == DEXINFO_MODE_COUNTS)
+		psprintf ("[] Total: %llu classes, %llu fields, %llu methods\n",
+			(unsigned long long)out.total_classes, (unsigned long long)out.total_fields, (unsigned long long)out.total_methods);
+
+done:
+#ifndef PYDEXINFO
+	if (cached)
+		cached->dex.budget = NULL;
+#endif
+	dex_unload(&dex);
+	dex_arena_release(&arena);
+
+	if (failed)
+		return parseFailed(1);
+
+#ifndef PYDEXINFO
+	/* the python module returns the partial output instead, see pydexinfo.partial() */
+	if (budget.status != DEX_BUDGET_OK)
+		return parseFailed(budget.status == DEX_BUDGET_CANCELLED ? 2 : 3);
+#endif
 
 #ifdef PYDEXINFO
 	return printbuf;
 #else
-	fclose(input);
 	return NULL;
 #endif
 }
 
+/* 512, 64k, 16m, 1g */
+static int parseSize(const char *str, size_t *size)
+{
+	char *end;
+	unsigned long long n = strtoull(str, &end, 10);
+
+	switch (*end) {
+	case 'g': case 'G':
+		n <<= 10;
+		/* fall through */
+	case 'm': case 'M':
+		n <<= 10;
+		/* fall through */
+	case 'k': case 'K':
+		n <<= 10;
+		end++;
+	}
+
+	if (end == str || *end != '\0' || n == 0 || n > SIZE_MAX)
+		return -1;
+
+	*size = n;
+	return 0;
+}
+
+/* 250ms, 2s, 1m, seconds without a suffix */
+static int parseTime(const char *str, u4 *ms)
+{
+	char *end;
+	unsigned long long n = strtoull(str, &end, 10), scale = 1;
+
+	if (strcmp(end, "ms") == 0) {
+		end += 2;
+	} else if (*end == 'm') {
+		scale = 60 * 1000;
+		end++;
+	} else {
+		scale = 1000;
+		if (*end == 's')
+			end++;
+	}
+
+	if (end == str || *end != '\0' || n == 0 || n > UINT32_MAX / scale)
+		return -1;
+
+	*ms = n * scale;
+	return 0;
+}
+
+/* one command line option, shared with the requests of the server */
+int dexinfo_option(int c, char *arg, dexinfo_options *opts)
+{
+	switch(c) {
+	case 'V':
+		opts->verbose=1;
+		break;
+	case 'H':
+		opts->mode=DEXINFO_MODE_HEADER;
+		break;
+	case 'c':
+		opts->mode=DEXINFO_MODE_COUNTS;
+		break;
+	case 'n':
+		opts->mode=DEXINFO_MODE_CLASSES;
+		break;
+	case 'l':
+		opts->mode=DEXINFO_MODE_LINES;
+		break;
+	case 'F':
+		opts->mode=DEXINFO_MODE_FINGERPRINTS;
+		break;
+	case 'i':
+		opts->mode=DEXINFO_MODE_SYMBOLS;
+		break;
+	case 'f':
+		opts->class_filter=arg;
+		break;
+	case 'a':
+		opts->mode=DEXINFO_MODE_ANNOTATIONS;
+		opts->type=arg;
+		break;
+	case 's':
+		opts->mode=DEXINFO_MODE_STATICS;
+		break;
+	case 'S':
+		opts->mode=DEXINFO_MODE_SUBCLASSES;
+		opts->type=arg;
+		break;
+	case 'I':
+		opts->mode=DEXINFO_MODE_IMPLEMENTORS;
+		opts->type=arg;
+		break;
+	case 'A':
+		opts->mode=DEXINFO_MODE_ANCESTORS;
+		opts->type=arg;
+		break;
+	case 'D':
+		opts->mode=DEXINFO_MODE_DIFF;
+		opts->other=arg;
+		break;
+	case 'E':
+		opts->mode=DEXINFO_MODE_EXPORT;
+		opts->output=arg;
+		break;
+	case 'g':
+		opts->mode=DEXINFO_MODE_STRINGS;
+		opts->type=arg;
+		break;
+	case 'M':
+		if (parseSize(arg, &opts->memory_limit) < 0) {
+			fprintf(stderr, "ERROR: invalid size %s\n", arg);
+			return -1;
+		}
+		break;
+	case 'T':
+		if (parseTime(arg, &opts->time_limit) < 0) {
+			fprintf(stderr, "ERROR: invalid time %s\n", arg);
+			return -1;
+		}
+		break;
+	case 'N':
+		if (parseSize(arg, &opts->item_limit) < 0) {
+			fprintf(stderr, "ERROR: invalid count %s\n", arg);
+			return -1;
+		}
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+#ifndef PYDEXINFO
+static volatile sig_atomic_t interrupted = 0;
+
+/* the first ^C ends the parse at the next class or member, the second one kills */
+static void interruptParse(int sig)
+{
+	interrupted = 1;
+}
+#endif
+
 int main(int argc, char *argv[])
 {
 	char *dexfile;
-	int DEBUG=0;
+	dexinfo_options opts;
 	int c;
+#ifndef PYDEXINFO
+	char *listen_path = NULL;
+	char *symbols_path = NULL;
+	dex_symbols *symbols;
+	int workers = 0;
+	struct sigaction sa;
+#endif
 
 	if (argc < 2) {
 		help_show_message();
@@ -806,18 +2218,53 @@ int main(int argc, char *argv[])
 
 	dexfile=argv[1];
 
-        while ((c = getopt(argc, argv, "V")) != -1) {
+	memset(&opts, 0, sizeof(opts));
+	opts.mode = DEXINFO_MODE_FULL;
+
+        while ((c = getopt(argc, argv, DEXINFO_OPTIONS "L:W:G:")) != -1) {
                 switch(c) {
-     		case 'V':
-			DEBUG=1;
+#ifndef PYDEXINFO
+		case 'L':
+			listen_path=optarg;
+			break;
+		case 'W':
+			workers=atoi(optarg);
+			break;
+		case 'G':
+			symbols_path=optarg;
 			break;
+#endif
                 default:
-                        help_show_message();
-                        return 1;
+			if (dexinfo_option(c, optarg, &opts) < 0) {
+				help_show_message();
+				return 1;
+			}
                 }
         }
 
-        dexinfo(dexfile, DEBUG);
+#ifndef PYDEXINFO
+	/* opened before the workers are forked, so that they all share it */
+	if (symbols_path || listen_path) {
+		symbols = dex_symbols_open(symbols_path);
+		if (symbols == NULL) {
+			fprintf(stderr, "ERROR: cannot map the symbol table %s: %s\n",
+				symbols_path ? symbols_path : "in memory", strerror(errno));
+			return 1;
+		}
+		dexinfo_use_symbols(symbols);
+	}
+
+	if (listen_path)
+		return dexinfo_serve(listen_path, workers) < 0;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = interruptParse;
+	sa.sa_flags = SA_RESETHAND;
+	sigaction(SIGINT, &sa, NULL);
+	opts.cancel = &interrupted;
+#endif
+
+        dexinfo(dexfile, &opts);
 
         return 0;
 }
@@ -0,0 +1,823 @@
+/*
+ * dexinfo - a very rudimentary dex file parser
+ *
+ * Copyright (C) 2014 Keith Makan (@k3170Makan)
+ * Copyright (C) 2012-2013 Pau Oliva Fora (@pof)
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEXINFO_H
+#define DEXINFO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#define MAX_BUFSIZE 1024
+
+#ifdef PYDEXINFO
+
+ssize_t dexinfo_read(uint8_t * buf, size_t len);
+void    dexinfo_seek(off_t offset, int whence);
+
+#define psseek(f, off, whence)		dexinfo_seek(off, whence)
+#define psread(buf, len, nmemb, f)	dexinfo_read((uint8_t *)buf, (len * nmemb))
+
+void printbuf_write(char * data);
+
+#define psprintf( ... )					\
+{							\
+	char tmp[MAX_BUFSIZE];				\
+	snprintf(tmp, MAX_BUFSIZE, __VA_ARGS__);	\
+	printbuf_write(tmp);				\
+}
+
+#else
+
+#define psseek(f, off, whence)		fseek(f, off, whence);
+
+#define psread(buf, len, nmemb, f)	fread(buf, len, nmemb, f)
+
+#define psprintf( ... )					\
+		printf( __VA_ARGS__ );
+#endif
+
+typedef uint8_t             u1;
+typedef uint16_t            u2;
+typedef uint32_t            u4;
+typedef uint64_t            u8;
+typedef int8_t              s1;
+typedef int16_t             s2;
+typedef int32_t             s4;
+typedef int64_t             s8;
+
+
+typedef struct {
+	char dex[3];
+	char newline[1];
+	char ver[3];
+	char zero[1];
+} dex_magic;
+
+typedef struct {
+	dex_magic magic;
+	u4 checksum[1];
+	unsigned char signature[20];
+	u4 file_size[1];
+	u4 header_size[1];
+	u4 endian_tag[1];
+	u4 link_size[1];
+	u4 link_off[1];
+	u4 map_off[1];
+	u4 string_ids_size[1];
+	u4 string_ids_off[1];
+	u4 type_ids_size[1];
+	u4 type_ids_off[1];
+	u4 proto_ids_size[1];
+	u4 proto_ids_off[1];
+	u4 field_ids_size[1];
+	u4 field_ids_off[1];
+	u4 method_ids_size[1];
+	u4 method_ids_off[1];
+	u4 class_defs_size[1];
+	u4 class_defs_off[1];
+	u4 data_size[1];
+	u4 data_off[1];
+} dex_header;
+
+typedef struct {
+	u4 class_idx[1];
+	u4 access_flags[1];
+	u4 superclass_idx[1];
+	u4 interfaces_off[1];
+	u4 source_file_idx[1];
+	u4 annotations_off[1];
+	u4 class_data_off[1];
+	u4 static_values_off[1];
+} class_def_struct;
+
+typedef struct {
+	u2 class_idx[1];
+	u2 proto_idx[1];
+	u4 name_idx[1];
+} method_id_struct;
+
+typedef struct {
+	u4 string_data_off[1];
+} string_id_struct;
+
+typedef struct {
+	u4 descriptor_idx[1];
+} type_id_struct;
+
+typedef struct {
+	u4 shorty_idx[1];
+	u4 return_type_idx[1];
+	u4 parameters_off[1];
+} proto_id_struct;
+
+typedef struct {
+	u2 class_idx[1];
+	u2 type_idx[1];
+	u4 name_idx[1];
+} field_id_struct;
+
+typedef struct {
+	u4 class_annotations_off[1];
+	u4 fields_size[1];
+	u4 annotated_methods_size[1];
+	u4 annotated_parameters_size[1];
+} annotations_directory_item;
+
+typedef struct {
+	u2 registers_size[1];
+	u2 ins_size[1];
+	u2 outs_size[1];
+	u2 tries_size[1];
+	u4 debug_info_off[1];
+	u4 insns_size[1];	/* in 16-bit code units */
+	u2 insns[];
+} code_item_struct;
+
+/* field_annotation, method_annotation and parameter_annotation share this layout */
+typedef struct {
+	u4 idx[1];
+	u4 annotations_off[1];
+} member_annotation_struct;
+
+extern const u4 NO_INDEX;
+
+typedef struct dex_arena_block dex_arena_block;
+
+/*
+ * Bump allocator for everything a parse needs besides the image itself,
+ * given back in one go by dex_arena_release(). With a limit set, an
+ * allocation that would take the arena past it fails and sets exceeded.
+ */
+typedef struct {
+	dex_arena_block *head;
+	void *last;		/* most recent allocation, grows in place */
+	size_t next_block;
+	size_t allocated;	/* bytes taken from malloc, block headers included */
+	size_t limit;		/* 0 for none */
+	int exceeded;
+} dex_arena;
+
+/* why a parse stopped early, dex_budget.status */
+#define DEX_BUDGET_OK		0
+#define DEX_BUDGET_CANCELLED	1	/* the cancel flag was set, the result is partial */
+#define DEX_BUDGET_TIME		2	/* budget exceeded, also partial */
+#define DEX_BUDGET_ITEMS	3
+#define DEX_BUDGET_MEMORY	4
+
+/*
+ * Limits of one parse beyond the memory cap of its arena, checked by the
+ * walks at class and member boundaries and inside the longer loops of the
+ * indexes, debug information, annotations and the export writer. Items are
+ * classes, the fields and methods of their class_data_items and the
+ * strings of a string scan; the other loops only check the time, the
+ * cancel flag and the memory cap.
+ */
+typedef struct {
+	u8 deadline;		/* CLOCK_MONOTONIC milliseconds, 0 for none */
+	u8 max_items;		/* 0 for none */
+	u8 items;
+	u8 checks;		/* calls to dex_budget_spend() */
+	u8 next_clock;		/* checks count at which the clock is read again */
+	volatile sig_atomic_t *cancel;	/* stops the parse when set, NULL for none */
+	int status;		/* DEX_BUDGET_* */
+} dex_budget;
+
+/*
+ * The whole dex file, loaded once per parse. The id tables point straight
+ * into the image so the decoder never has to seek or copy to reach them.
+ */
+typedef struct {
+	u1 *base;
+	size_t size;
+	int mapped;
+	int borrowed;		/* base belongs to the caller, see dex_load_memory() */
+	dex_arena *arena;	/* where indexes built over this image are allocated */
+	dex_budget *budget;	/* limits of the parse, NULL for none */
+
+	dex_header *header;
+	string_id_struct *string_ids;
+	type_id_struct *type_ids;
+	proto_id_struct *proto_ids;
+	field_id_struct *field_ids;
+	method_id_struct *method_ids;
+	class_def_struct *class_defs;
+} dex_image;
+
+/* true when [off, off + len) lies inside the image */
+#define dex_in_image(dex, off, len)	((u8)(off) + (u8)(len) <= (u8)(dex)->size)
+
+/* output projections, each one skips the decoding it does not print */
+#define DEXINFO_MODE_FULL	0	/* header, classes, fields and methods */
+#define DEXINFO_MODE_HEADER	1	/* dex header only */
+#define DEXINFO_MODE_COUNTS	2	/* field and method counts per class */
+#define DEXINFO_MODE_CLASSES	3	/* class descriptors only */
+#define DEXINFO_MODE_ANNOTATIONS 4	/* members carrying the annotation type in 'type' */
+#define DEXINFO_MODE_STATICS	5	/* initial values of static fields */
+#define DEXINFO_MODE_SUBCLASSES	6	/* classes extending the types in 'type' */
+#define DEXINFO_MODE_IMPLEMENTORS 7	/* classes implementing the types in 'type' */
+#define DEXINFO_MODE_ANCESTORS	8	/* superclass chain of the types in 'type' */
+#define DEXINFO_MODE_DIFF	9	/* classes and members changed in 'other' */
+#define DEXINFO_MODE_EXPORT	10	/* columnar tables written to 'output' */
+#define DEXINFO_MODE_LINES	11	/* line tables and locals of every method */
+#define DEXINFO_MODE_FINGERPRINTS 12	/* normalized bytecode fingerprints of methods and classes */
+#define DEXINFO_MODE_STRINGS	13	/* strings matching the comma separated patterns in 'type' */
+#define DEXINFO_MODE_SYMBOLS	14	/* type, field and method references as shared symbol ids */
+
+typedef struct {
+	int verbose;
+	int mode;
+	const char *class_filter;	/* fnmatch(3) pattern on class descriptors, NULL for all */
+	const char *type;		/* type descriptor argument, comma separated for the hierarchy modes */
+	char *other;			/* second dex file for DEXINFO_MODE_DIFF */
+	u1 *other_data;			/* or its contents, when there is no file to open */
+	size_t other_size;
+	const char *output;		/* file written by DEXINFO_MODE_EXPORT */
+	size_t memory_limit;		/* bytes a parse may allocate, 0 for no limit */
+	u4 time_limit;			/* milliseconds a parse may take, 0 for no limit */
+	size_t item_limit;		/* classes, fields and methods a parse may decode, 0 for no limit */
+	volatile sig_atomic_t *cancel;	/* set to stop the parse with a partial result */
+} dexinfo_options;
+
+/* getopt(3) string of the options dexinfo_option() understands */
+#define DEXINFO_OPTIONS		"VHcnlFif:a:sS:I:A:D:E:g:M:T:N:"
+/* those a server request may carry: not -D and -E, which name files of their own */
+#define DEXINFO_REQUEST_OPTIONS	"VHcnlFif:a:sS:I:A:g:M:T:N:"
+
+/* annotation visibility, annotation_item.visibility */
+#define DEX_VISIBILITY_BUILD	0x00
+#define DEX_VISIBILITY_RUNTIME	0x01
+#define DEX_VISIBILITY_SYSTEM	0x02
+
+/* where an annotation was found */
+#define DEX_ANNOTATION_CLASS		0
+#define DEX_ANNOTATION_FIELD		1
+#define DEX_ANNOTATION_METHOD		2
+#define DEX_ANNOTATION_PARAMETER	3
+
+/*
+ * An annotation_item viewed in place. Only the header is decoded, the
+ * elements stay encoded until somebody walks them.
+ */
+typedef struct {
+	u1 visibility;
+	u4 type_idx;
+	u4 size;		/* number of name/value elements */
+	u1 *elements;
+} dex_annotation;
+
+typedef struct {
+	int kind;		/* DEX_ANNOTATION_* */
+	u4 class_def_idx;
+	u4 member_idx;		/* field_idx or method_idx, unused for classes */
+	u4 param;		/* parameter position for DEX_ANNOTATION_PARAMETER */
+	dex_annotation annotation;
+} dex_annotation_hit;
+
+typedef void (*dex_annotation_cb)(const dex_image *dex, const dex_annotation_hit *hit, void *ctx);
+
+/*
+ * Class hierarchy of one dex, indexed by type_idx so that types defined
+ * elsewhere (android.webkit.WebViewClient, java.lang.Runnable...) can be
+ * queried too. Children and implementors are singly linked lists threaded
+ * through class_def indexes, so a query only touches what it returns.
+ */
+typedef struct {
+	u4 class_def_idx;
+	u4 next;
+} dex_hierarchy_edge;
+
+/* built in the arena of the dex, it lives as long as the parse */
+typedef struct {
+	u4 types;
+	u4 classes;
+	u4 *class_of_type;	/* class_def defining each type, NO_INDEX when external */
+	u4 *child_head;		/* per type, first class_def extending it */
+	u4 *child_next;		/* per class_def, next class_def with the same superclass */
+	u4 *impl_head;		/* per type, first edge of the classes implementing it */
+	dex_hierarchy_edge *impl;
+	u4 impl_size;
+	u4 impl_alloc;
+	u4 *stack;		/* query scratch, one slot per class_def */
+	u4 *seen;		/* per class_def, stamp of the last query that reached it */
+	u4 stamp;
+} dex_hierarchy;
+
+/* dex_hierarchy_descendants() flags */
+#define DEX_HIERARCHY_SUBCLASSES	0x1	/* follow superclass links */
+#define DEX_HIERARCHY_IMPLEMENTORS	0x2	/* follow interfaces links */
+#define DEX_HIERARCHY_DIRECT		0x4	/* only the first level */
+
+/* class_def_idx is NO_INDEX for types that are not defined in this dex */
+typedef void (*dex_hierarchy_cb)(const dex_image *dex, u4 type_idx, u4 class_def_idx, void *ctx);
+
+/* what the index operand of an instruction refers to */
+#define INDEX_NONE		0
+#define INDEX_STRING		1
+#define INDEX_TYPE		2
+#define INDEX_FIELD		3
+#define INDEX_METHOD		4
+#define INDEX_PROTO		5
+#define INDEX_CALL_SITE		6
+#define INDEX_METHOD_HANDLE	7
+
+/* instruction formats, named as in the Dalvik bytecode format reference */
+enum {
+	FMT_10x, FMT_12x, FMT_11n, FMT_11x, FMT_10t, FMT_20t, FMT_22x, FMT_21t,
+	FMT_21s, FMT_21h, FMT_21c, FMT_23x, FMT_22b, FMT_22t, FMT_22s, FMT_22c,
+	FMT_32x, FMT_30t, FMT_31t, FMT_31i, FMT_31c, FMT_35c, FMT_3rc, FMT_45cc,
+	FMT_4rcc, FMT_51l, FMT_PAYLOAD
+};
+
+/* an instruction viewed in place in a code_item */
+typedef struct {
+	const u2 *insn;
+	u4 width;		/* in code units */
+	u1 opcode;
+	u1 format;		/* FMT_* */
+	u1 index_kind;		/* INDEX_* */
+	u4 index;
+} dex_insn;
+
+/*
+ * Per dex content hashes of strings, computed the first time an index is
+ * looked at. Hashes of types, fields, methods and protos are derived from
+ * them, so they match between dex files whatever the indexes are.
+ */
+typedef struct {
+	const dex_image *dex;
+	u8 *strings;		/* 0 until computed, in the arena of dex */
+} dex_hashes;
+
+/* what a catch type adds to the hash of the tries of a method, see dex_tries_hash() */
+typedef u8 (*dex_catch_hash_cb)(void *ctx, u4 type_idx);
+
+/* scratch of dex_method_fingerprint(), in the arena of the dex */
+typedef struct {
+	dex_hashes hashes;
+	u1 *platform;		/* per type_idx, whether it belongs to the platform */
+	u2 *units;		/* normalized instructions of the method */
+	u4 size;
+	u4 alloc;
+	u4 *seen;		/* per register, stamp of the method that numbered it */
+	u4 *canon;		/* per register, its number in that method */
+	u4 regs_alloc;
+	u4 stamp;
+	u4 next_reg;
+} dex_fingerprint;
+
+/* value_type of an encoded_value, the low five bits of its first byte */
+#define VALUE_BYTE		0x00
+#define VALUE_SHORT		0x02
+#define VALUE_CHAR		0x03
+#define VALUE_INT		0x04
+#define VALUE_LONG		0x06
+#define VALUE_FLOAT		0x10
+#define VALUE_DOUBLE		0x11
+#define VALUE_METHOD_TYPE	0x15
+#define VALUE_METHOD_HANDLE	0x16
+#define VALUE_STRING		0x17
+#define VALUE_TYPE		0x18
+#define VALUE_FIELD		0x19
+#define VALUE_METHOD		0x1a
+#define VALUE_ENUM		0x1b
+#define VALUE_ARRAY		0x1c
+#define VALUE_ANNOTATION	0x1d
+#define VALUE_NULL		0x1e
+#define VALUE_BOOLEAN		0x1f
+
+/*
+ * A decoded encoded_value. Scalars are decoded, arrays and annotations are
+ * left in the image and walked with another dex_value_iter.
+ */
+typedef struct {
+	u1 type;
+	union {
+		s8 s;			/* byte, short, char, int and long, sign or zero extended */
+		float f;
+		double d;
+		u4 idx;			/* method_type, method_handle, string, type, field, method, enum */
+		int z;
+		struct {
+			u4 size;
+			u1 *values;
+		} array;
+		dex_annotation annotation;
+	} v;
+} dex_value;
+
+/* walks an encoded_array or the name/value elements of an encoded_annotation */
+typedef struct {
+	const dex_image *dex;
+	u1 *ptr;
+	u4 remaining;
+	int elements;
+} dex_value_iter;
+
+int readUnsignedLeb128(u1** pStream);
+int uleb128_value(u1* pStream);
+size_t len_uleb128(unsigned long n);
+u4 dex_uleb128(const dex_image *dex, u1 **pStream);
+s4 dex_sleb128(const dex_image *dex, u1 **pStream);
+
+u8 dex_hash(const void *data, size_t len, u8 seed);
+u8 dex_hash_mix(u8 h, u8 v);
+
+int dex_load(dex_image *dex, char *dexfile, int header_only, dex_arena *arena);
+int dex_load_memory(dex_image *dex, u1 *base, size_t size, dex_arena *arena);
+void dex_unload(dex_image *dex);
+const char * dex_string(const dex_image *dex, u4 string_idx);
+const char * dex_type_desc(const dex_image *dex, u4 type_idx);
+int dex_string_compare(const char *a, const char *b);
+u4 dex_find_type(const dex_image *dex, const char *desc);
+const u2 * dex_type_list(const dex_image *dex, u4 off, u4 *size);
+
+/* arena.c */
+void dex_arena_init(dex_arena *arena, size_t limit);
+void * dex_arena_alloc(dex_arena *arena, size_t size);
+void * dex_arena_calloc(dex_arena *arena, size_t n, size_t size);
+void * dex_arena_grow(dex_arena *arena, void *ptr, size_t old_size, size_t size);
+void dex_arena_release(dex_arena *arena);
+
+/* budget.c */
+void dex_budget_init(dex_budget *budget, u4 time_limit, u8 max_items, volatile sig_atomic_t *cancel);
+int dex_budget_spend(const dex_image *dex, u4 items);
+const char * dex_budget_reason(int status);
+
+/* annotations.c */
+const annotations_directory_item * dex_annotations_dir(const dex_image *dex, const class_def_struct *class_def);
+const member_annotation_struct * dex_annotations_members(const dex_image *dex, const annotations_directory_item *dir, int kind);
+u4 dex_annotation_set_size(const dex_image *dex, u4 set_off);
+int dex_annotation_at(const dex_image *dex, u4 set_off, u4 i, dex_annotation *annotation);
+u4 dex_annotation_ref_list_size(const dex_image *dex, u4 list_off);
+u4 dex_annotation_ref_list_at(const dex_image *dex, u4 list_off, u4 i);
+int dex_annotations_walk(const dex_image *dex, u4 class_def_idx, u4 type_idx, dex_annotation_cb cb, void *ctx);
+
+/* code.c */
+const code_item_struct * dex_code_item(const dex_image *dex, u4 off);
+int dex_insn_decode(const code_item_struct *code, u4 pc, dex_insn *insn);
+int dex_hashes_init(const dex_image *dex, dex_hashes *hashes);
+u8 dex_string_hash(dex_hashes *hashes, u4 string_idx);
+u8 dex_type_hash(dex_hashes *hashes, u4 type_idx);
+u8 dex_proto_hash(dex_hashes *hashes, u4 proto_idx);
+u8 dex_field_hash(dex_hashes *hashes, u4 field_idx);
+u8 dex_method_hash(dex_hashes *hashes, u4 method_idx);
+u8 dex_index_hash(dex_hashes *hashes, int index_kind, u4 index);
+u8 dex_tries_hash(const dex_image *dex, const code_item_struct *code, u8 h, dex_catch_hash_cb cb, void *ctx);
+u8 dex_code_hash(dex_hashes *hashes, const code_item_struct *code);
+
+/* diff.c */
+#define DEX_DIFF_ADDED		0
+#define DEX_DIFF_REMOVED	1
+#define DEX_DIFF_CHANGED	2
+
+#define DEX_DIFF_CLASS		0
+#define DEX_DIFF_FIELD		1
+#define DEX_DIFF_METHOD		2
+
+/* what changed, dex_diff_entry.reasons */
+#define DEX_DIFF_FLAGS		0x01
+#define DEX_DIFF_SUPERCLASS	0x02
+#define DEX_DIFF_INTERFACES	0x04
+#define DEX_DIFF_FIELDS		0x08
+#define DEX_DIFF_METHODS	0x10
+#define DEX_DIFF_CODE		0x20
+
+/*
+ * One difference. old_idx and new_idx are class_def indexes for classes,
+ * field_idx or method_idx for members, NO_INDEX on the side it is missing.
+ * Member entries follow the DEX_DIFF_CHANGED entry of their class.
+ */
+typedef struct {
+	int kind;		/* DEX_DIFF_ADDED, REMOVED or CHANGED */
+	int what;		/* DEX_DIFF_CLASS, FIELD or METHOD */
+	u4 old_idx;
+	u4 new_idx;
+	u4 reasons;
+} dex_diff_entry;
+
+typedef void (*dex_diff_cb)(const dex_image *old_dex, const dex_image *new_dex, const dex_diff_entry *entry, void *ctx);
+
+int dex_diff(const dex_image *old_dex, const dex_image *new_dex, dex_diff_cb cb, void *ctx);
+
+/* export.c */
+int dex_export(const dex_image *dex, const char *class_filter, FILE *out, u4 *rows);
+
+/* fingerprint.c */
+int dex_fingerprint_init(const dex_image *dex, dex_fingerprint *fp);
+u8 dex_method_fingerprint(dex_fingerprint *fp, const code_item_struct *code);
+u8 dex_class_fingerprint(u8 class_fp, u8 method_fp);
+
+/* hierarchy.c */
+int dex_hierarchy_build(const dex_image *dex, dex_hierarchy *hierarchy);
+int dex_hierarchy_descendants(const dex_image *dex, dex_hierarchy *hierarchy, u4 type_idx, int flags,
+		dex_hierarchy_cb cb, void *ctx);
+int dex_hierarchy_ancestors(const dex_image *dex, dex_hierarchy *hierarchy, u4 type_idx,
+		dex_hierarchy_cb cb, void *ctx);
+
+/*
+ * Event interface over the classes of a dex, for callers that want the
+ * decoded items and not the text output. dex_visit() calls header once,
+ * then for every class class_begin, members before each of its four
+ * class_data lists, field and method for every entry and class_end. Any
+ * callback may be NULL; the walk is specialized on which ones are set, so
+ * lists nobody asked for are not decoded at all. When the budget of the
+ * dex runs out the walk returns at once, without class_end for the class
+ * it was in.
+ */
+#define DEX_STATIC_FIELDS	0
+#define DEX_INSTANCE_FIELDS	1
+#define DEX_DIRECT_METHODS	2
+#define DEX_VIRTUAL_METHODS	3
+
+typedef struct {
+	u4 class_def_idx;
+	const class_def_struct *class_def;
+	u4 counts[4];		/* entries per list, indexed by DEX_STATIC_FIELDS... */
+} dex_class;
+
+typedef struct {
+	int kind;		/* DEX_STATIC_FIELDS or DEX_INSTANCE_FIELDS */
+	u4 position;		/* in its list */
+	u4 field_idx;
+	u4 access_flags;
+	const dex_value *value;	/* initial value of a static field, see DEX_VISIT_STATIC_VALUES */
+} dex_field;
+
+typedef struct {
+	int kind;		/* DEX_DIRECT_METHODS or DEX_VIRTUAL_METHODS */
+	u4 position;
+	u4 method_idx;		/* not checked against method_ids_size */
+	u4 access_flags;
+	u4 code_off;
+} dex_method;
+
+/* dex_visitor.flags */
+#define DEX_VISIT_COUNTS	1	/* fill dex_class.counts even without member callbacks */
+#define DEX_VISIT_STATIC_VALUES	2	/* decode static_values_off for dex_field.value */
+
+typedef struct {
+	int (*header)(const dex_image *dex, void *ctx);		/* non zero ends the walk */
+	int (*class_begin)(const dex_image *dex, const dex_class *cls, void *ctx);	/* non zero skips the class */
+	int (*members)(const dex_image *dex, const dex_class *cls, int kind, void *ctx);	/* non zero ends the class */
+	void (*field)(const dex_image *dex, const dex_class *cls, const dex_field *field, void *ctx);
+	void (*method)(const dex_image *dex, const dex_class *cls, const dex_method *method, void *ctx);
+	void (*class_end)(const dex_image *dex, const dex_class *cls, void *ctx);
+	int flags;
+} dex_visitor;
+
+/*
+ * Debug information of a method, decoded from its debug_info_item on
+ * request. Positions map bytecode addresses (in code units) to source
+ * lines, in address order. Locals cover [start, end) of their register;
+ * indexes that the item leaves out are NO_INDEX.
+ */
+typedef struct {
+	u4 address;
+	u4 line;
+} dex_debug_position;
+
+/* dex_debug_local.flags */
+#define DEX_DEBUG_THIS		0x1	/* the implicit this argument, name_idx is NO_INDEX */
+#define DEX_DEBUG_PARAMETER	0x2
+
+typedef struct {
+	u4 start;
+	u4 end;
+	u4 name_idx;
+	u4 type_idx;
+	u4 signature_idx;
+	u2 reg;
+	u2 flags;
+} dex_debug_local;
+
+typedef struct {
+	u4 file_idx;		/* string_idx of DBG_SET_FILE, NO_INDEX when the class source file applies */
+	u4 positions_size;
+	u4 locals_size;
+	dex_debug_position *positions;
+	dex_debug_local *locals;
+} dex_debug_info;
+
+/* decoded methods by method_idx, in the arena of the dex */
+typedef struct {
+	const dex_image *dex;
+	dex_debug_info **methods;
+	/* scratch of the decoder */
+	dex_debug_position *positions;
+	u4 positions_size;
+	u4 positions_alloc;
+	dex_debug_local *locals;
+	u4 locals_size;
+	u4 locals_alloc;
+	u4 *live;		/* per register, local live in it */
+	u4 *last;		/* per register, last local started in it, for DBG_RESTART_LOCAL */
+	u4 regs_alloc;
+	int failed;		/* out of memory */
+} dex_debug;
+
+/*
+ * Patterns of dex_strings_scan(), compiled into one Aho-Corasick automaton
+ * over the literal part of every pattern, in an arena.
+ */
+typedef struct {
+	const char *glob;	/* fnmatch(3) pattern to confirm with, NULL for a plain substring */
+	u4 same;		/* next pattern with the same literal part */
+} dex_pattern;
+
+typedef struct {
+	dex_pattern *patterns;
+	u4 patterns_size;
+	u4 states;
+	u4 *next;		/* 256 transitions per state, failures folded in */
+	u4 *out;		/* per state, first pattern whose literal part ends there */
+	u4 *dict;		/* per state, next state down its failure chain with an out */
+	u4 *unkeyed;		/* globs without a literal part, tried on every string */
+	u4 unkeyed_size;
+	u4 *tried;		/* per pattern, stamp of the last string its glob ran on */
+	u4 stamp;
+} dex_matcher;
+
+/* a string that matched, str is valid during the callback only */
+typedef struct {
+	u4 string_idx;
+	u4 utf16_size;
+	const char *str;	/* UTF-8, NUL terminated */
+	u4 len;			/* bytes */
+	int ascii;		/* str points into the image */
+	int valid;		/* well formed MUTF-8 of utf16_size units */
+	u4 pattern;		/* lowest numbered pattern it matched */
+} dex_string_hit;
+
+typedef void (*dex_string_cb)(const dex_image *dex, const dex_string_hit *hit, void *ctx);
+typedef void (*dex_string_ref_cb)(const dex_image *dex, u4 string_idx, u4 class_def_idx, void *ctx);
+
+/*
+ * Columnar export of the class, field and method tables, see export.c for
+ * the layout. The structs are the file format, little endian, for loaders
+ * that map the file.
+ */
+#define DEX_EXPORT_MAGIC	"dexcol\n"	/* with its NUL, 8 bytes */
+#define DEX_EXPORT_VERSION	1
+#define DEX_EXPORT_NAME		16
+
+#define DEX_EXPORT_CLASSES	0
+#define DEX_EXPORT_FIELDS	1
+#define DEX_EXPORT_METHODS	2
+#define DEX_EXPORT_TABLES	3
+
+/* dex_export_column.encoding */
+#define DEX_EXPORT_FIXED	0	/* rows values of width bytes */
+#define DEX_EXPORT_DELTA	1	/* ULEB128 difference from the previous value */
+
+typedef struct {
+	u1 magic[8];
+	u4 version;
+	u4 table_count;
+	u4 column_count;
+	u4 tables_off;
+	u4 columns_off;
+	u4 dict_off;
+} dex_export_header;
+
+typedef struct {
+	char name[DEX_EXPORT_NAME];
+	u4 rows;
+	u4 first_column;	/* index in the column directory */
+	u4 column_count;
+	u4 reserved;
+} dex_export_table;
+
+typedef struct {
+	char name[DEX_EXPORT_NAME];
+	u1 encoding;		/* DEX_EXPORT_FIXED or DEX_EXPORT_DELTA */
+	u1 width;		/* bytes per value when fixed */
+	u1 strings;		/* values are dictionary ids */
+	u1 table;
+	u4 rows;
+	u8 off;			/* from the start of the file */
+	u8 size;		/* bytes */
+} dex_export_column;
+
+/*
+ * Symbol table shared between parses, processes and runs, see symbols.c.
+ * The header is the start of the shared mapping; next_id and bytes_used
+ * are only changed with atomic operations.
+ */
+#define DEX_SYMBOLS_MAGIC	"dexsym\n"	/* with its NUL, 8 bytes */
+#define DEX_SYMBOLS_VERSION	2
+
+typedef struct {
+	u1 magic[8];
+	u4 version;
+	u4 slots;		/* a power of two */
+	u4 max_ids;
+	u4 next_id;		/* ids start at 1, 0 stands for none */
+	u8 bytes_size;
+	u8 bytes_used;
+} dex_symbols_header;
+
+typedef struct dex_symbols dex_symbols;
+
+/* ids of the strings and prototypes of one dex, in its arena, 0 until looked up */
+typedef struct {
+	const dex_image *dex;
+	dex_symbols *symbols;
+	u4 *strings;		/* per string_idx */
+	u4 *protos;		/* per proto_idx, of "(params)ret" */
+	char *scratch;
+	u4 scratch_alloc;
+} dex_symbol_map;
+
+/*
+ * Images kept mapped between parses by a long running process, keyed by
+ * the signature in their header, along with the indexes built over them.
+ */
+typedef struct {
+	u1 signature[20];
+	u4 checksum;
+	u4 file_size;
+	u8 last_used;		/* 0 for a free slot */
+	dex_image dex;
+	dex_arena arena;	/* indexes over dex, kept as long as the entry */
+	dex_hierarchy hierarchy;
+	int has_hierarchy;
+	dex_debug debug;
+	int has_debug;
+} dex_cache_entry;
+
+typedef struct {
+	dex_cache_entry *entries;
+	u4 size;
+	u8 clock;
+} dex_cache;
+
+/* cache.c, command line tool only */
+int dex_cache_init(dex_cache *cache, u4 size);
+dex_cache_entry * dex_cache_get(dex_cache *cache, char *dexfile);
+dex_hierarchy * dex_cache_hierarchy(dex_cache_entry *entry);
+dex_debug * dex_cache_debug(dex_cache_entry *entry);
+void dex_cache_free(dex_cache *cache);
+
+/* server.c, command line tool only */
+int dexinfo_serve(const char *socket_path, int workers);
+
+/* debug.c */
+void dex_debug_init(const dex_image *dex, dex_debug *debug);
+const dex_debug_info * dex_debug_get(dex_debug *debug, u4 method_idx, u4 access_flags, u4 code_off);
+u4 dex_debug_line(const dex_debug_info *info, u4 address);
+
+/* strings.c */
+int dex_matcher_build(const dex_image *dex, const char *patterns, dex_matcher *matcher);
+int dex_strings_scan(const dex_image *dex, dex_matcher *matcher, dex_string_cb cb, void *ctx);
+int dex_string_refs(const dex_image *dex, const u1 *wanted, const char *class_filter, dex_string_ref_cb cb, void *ctx);
+
+/* symbols.c */
+dex_symbols * dex_symbols_open(const char *path);
+void dex_symbols_close(dex_symbols *symbols);
+u4 dex_symbols_intern(dex_symbols *symbols, const char *str, size_t len);
+const char * dex_symbols_string(const dex_symbols *symbols, u4 id);
+u4 dex_symbols_count(const dex_symbols *symbols);
+int dex_symbol_map_init(const dex_image *dex, dex_symbols *symbols, dex_symbol_map *map);
+u4 dex_string_symbol(dex_symbol_map *map, u4 string_idx);
+u4 dex_type_symbol(dex_symbol_map *map, u4 type_idx);
+u4 dex_proto_symbol(dex_symbol_map *map, u4 proto_idx);
+
+/* visit.c */
+int dex_visit(const dex_image *dex, const dex_visitor *visitor, void *ctx);
+
+/* values.c */
+int dex_encoded_array(const dex_image *dex, u4 off, dex_value_iter *it);
+void dex_array_values(const dex_image *dex, const dex_value *array, dex_value_iter *it);
+void dex_annotation_elements(const dex_image *dex, const dex_annotation *annotation, dex_value_iter *it);
+int dex_value_next(dex_value_iter *it, u4 *name_idx, dex_value *value);
+
+char * dexinfo(char * dexfile, const dexinfo_options * opts);
+int dexinfo_option(int c, char *arg, dexinfo_options *opts);
+void dexinfo_use_cache(dex_cache *cache);
+int dexinfo_status(void);
+void dexinfo_use_symbols(dex_symbols *symbols);
+void help_show_message();
+
+#endif
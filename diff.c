@@ -0,0 +1,437 @@
+/*
+ * dexinfo - a very rudimentary dex file parser
+ *
+ * Copyright (C) 2014 Keith Makan (@k3170Makan)
+ * Copyright (C) 2012-2013 Pau Oliva Fora (@pof)
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Structural diff of two dex files. Classes are matched by descriptor and
+ * members by name and type, never by index, so a rebuilt dex with its
+ * tables renumbered only shows what really changed. type_ids, field_ids
+ * and method_ids are sorted by content in every valid dex, which lets
+ * both sides be walked as sorted merges without building any map.
+ */
+
+#include "dexinfo.h"
+
+typedef struct {
+	u4 idx;			/* field_idx or method_idx */
+	u4 access_flags;
+	u4 code_off;
+} diff_member;
+
+typedef struct {
+	diff_member *items;
+	u4 size;
+	u4 alloc;
+} member_list;
+
+/* one dex file of the pair */
+typedef struct {
+	const dex_image *dex;
+	dex_hashes hashes;
+	u4 *class_of_type;
+	member_list fields;
+	member_list methods;
+} diff_side;
+
+typedef struct {
+	diff_side old_side;
+	diff_side new_side;
+	dex_diff_entry *pending;	/* member entries of the current class */
+	u4 pending_size;
+	u4 pending_alloc;
+	dex_diff_cb cb;
+	void *ctx;
+} diff_state;
+
+static int member_push(dex_arena *arena, member_list *list, u4 idx, u4 access_flags, u4 code_off)
+{
+	diff_member *items;
+	u4 alloc;
+
+	if (list->size == list->alloc) {
+		alloc = list->alloc ? list->alloc * 2 : 64;
+		items = dex_arena_grow(arena, list->items, list->alloc * sizeof(*items), alloc * sizeof(*items));
+		if (items == NULL)
+			return -1;
+		list->items = items;
+		list->alloc = alloc;
+	}
+
+	list->items[list->size].idx = idx;
+	list->items[list->size].access_flags = access_flags;
+	list->items[list->size].code_off = code_off;
+	list->size++;
+
+	return 0;
+}
+
+static int compare_member(const void *a, const void *b)
+{
+	u4 x = ((const diff_member *)a)->idx;
+	u4 y = ((const diff_member *)b)->idx;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Members of a class in field_idx or method_idx order, which is also their
+ * name and type order. Static and instance fields land in one list, as do
+ * direct and virtual methods.
+ */
+static int collect_members(diff_side *side, const class_def_struct *class_def)
+{
+	const dex_image *dex = side->dex;
+	u1 *ptr, *end;
+	u4 counts[4], i, j, idx, flags, code_off;
+
+	side->fields.size = 0;
+	side->methods.size = 0;
+
+	if (*class_def->class_data_off == 0 || !dex_in_image(dex, *class_def->class_data_off, 1))
+		return 0;
+
+	ptr = dex->base + *class_def->class_data_off;
+	end = dex->base + dex->size;
+	for (i = 0; i < 4; i++)
+		counts[i] = dex_uleb128(dex, &ptr);
+
+	for (i = 0; i < 4; i++) {
+		idx = 0;
+		for (j = 0; j < counts[i] && ptr < end; j++) {
+			if (dex->budget && dex_budget_spend(dex, 1))
+				return 0;
+			idx += dex_uleb128(dex, &ptr);
+			flags = dex_uleb128(dex, &ptr);
+			code_off = i < 2 ? 0 : dex_uleb128(dex, &ptr);
+			if (member_push(dex->arena, i < 2 ? &side->fields : &side->methods, idx, flags, code_off) < 0)
+				return -1;
+		}
+	}
+
+	if (counts[0] && counts[1])
+		qsort(side->fields.items, side->fields.size, sizeof(diff_member), compare_member);
+	if (counts[2] && counts[3])
+		qsort(side->methods.items, side->methods.size, sizeof(diff_member), compare_member);
+
+	return 0;
+}
+
+static int compare_strings(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL)
+		return (a != NULL) - (b != NULL);
+	return dex_string_compare(a, b);
+}
+
+static int compare_types(const dex_image *a, u4 a_idx, const dex_image *b, u4 b_idx)
+{
+	if (a_idx == NO_INDEX || b_idx == NO_INDEX)
+		return (a_idx != NO_INDEX) - (b_idx != NO_INDEX);
+	return compare_strings(dex_type_desc(a, a_idx), dex_type_desc(b, b_idx));
+}
+
+/* the order proto_ids are sorted in: return type, then the parameters */
+static int compare_protos(const dex_image *a, u4 a_idx, const dex_image *b, u4 b_idx)
+{
+	const proto_id_struct *pa, *pb;
+	const u2 *a_params, *b_params;
+	u4 a_size, b_size, i;
+	int cmp;
+
+	if (a_idx >= *a->header->proto_ids_size || b_idx >= *b->header->proto_ids_size)
+		return (a_idx < *a->header->proto_ids_size) - (b_idx < *b->header->proto_ids_size);
+
+	pa = &a->proto_ids[a_idx];
+	pb = &b->proto_ids[b_idx];
+	cmp = compare_types(a, *pa->return_type_idx, b, *pb->return_type_idx);
+	if (cmp)
+		return cmp;
+
+	a_params = dex_type_list(a, *pa->parameters_off, &a_size);
+	b_params = dex_type_list(b, *pb->parameters_off, &b_size);
+	for (i = 0; i < a_size && i < b_size; i++) {
+		cmp = compare_types(a, a_params[i], b, b_params[i]);
+		if (cmp)
+			return cmp;
+	}
+
+	return (a_size > b_size) - (a_size < b_size);
+}
+
+static int compare_fields(const dex_image *a, u4 a_idx, const dex_image *b, u4 b_idx)
+{
+	int cmp;
+
+	if (a_idx >= *a->header->field_ids_size || b_idx >= *b->header->field_ids_size)
+		return (a_idx < *a->header->field_ids_size) - (b_idx < *b->header->field_ids_size);
+
+	cmp = compare_strings(dex_string(a, *a->field_ids[a_idx].name_idx), dex_string(b, *b->field_ids[b_idx].name_idx));
+	if (cmp)
+		return cmp;
+	return compare_types(a, *a->field_ids[a_idx].type_idx, b, *b->field_ids[b_idx].type_idx);
+}
+
+static int compare_methods(const dex_image *a, u4 a_idx, const dex_image *b, u4 b_idx)
+{
+	int cmp;
+
+	if (a_idx >= *a->header->method_ids_size || b_idx >= *b->header->method_ids_size)
+		return (a_idx < *a->header->method_ids_size) - (b_idx < *b->header->method_ids_size);
+
+	cmp = compare_strings(dex_string(a, *a->method_ids[a_idx].name_idx), dex_string(b, *b->method_ids[b_idx].name_idx));
+	if (cmp)
+		return cmp;
+	return compare_protos(a, *a->method_ids[a_idx].proto_idx, b, *b->method_ids[b_idx].proto_idx);
+}
+
+static int add_pending(diff_state *state, int kind, int what, u4 old_idx, u4 new_idx, u4 reasons)
+{
+	dex_diff_entry *pending;
+	u4 alloc;
+
+	if (state->pending_size == state->pending_alloc) {
+		alloc = state->pending_alloc ? state->pending_alloc * 2 : 64;
+		pending = dex_arena_grow(state->old_side.dex->arena, state->pending,
+			state->pending_alloc * sizeof(*pending), alloc * sizeof(*pending));
+		if (pending == NULL)
+			return -1;
+		state->pending = pending;
+		state->pending_alloc = alloc;
+	}
+
+	pending = &state->pending[state->pending_size++];
+	pending->kind = kind;
+	pending->what = what;
+	pending->old_idx = old_idx;
+	pending->new_idx = new_idx;
+	pending->reasons = reasons;
+
+	return 0;
+}
+
+static u4 method_reasons(diff_state *state, const diff_member *a, const diff_member *b)
+{
+	const code_item_struct *a_code, *b_code;
+	u4 reasons = 0;
+
+	if (a->access_flags != b->access_flags)
+		reasons |= DEX_DIFF_FLAGS;
+
+	a_code = dex_code_item(state->old_side.dex, a->code_off);
+	b_code = dex_code_item(state->new_side.dex, b->code_off);
+	if ((a_code == NULL) != (b_code == NULL))
+		reasons |= DEX_DIFF_CODE;
+	else if (a_code && dex_code_hash(&state->old_side.hashes, a_code) != dex_code_hash(&state->new_side.hashes, b_code))
+		reasons |= DEX_DIFF_CODE;
+
+	return reasons;
+}
+
+/* merge two sorted member lists, queueing an entry for every difference */
+static int diff_members(diff_state *state, int what, const member_list *a, const member_list *b)
+{
+	const dex_image *a_dex = state->old_side.dex, *b_dex = state->new_side.dex;
+	u4 i = 0, j = 0, reasons;
+	int cmp;
+
+	while (i < a->size || j < b->size) {
+		if (i == a->size)
+			cmp = 1;
+		else if (j == b->size)
+			cmp = -1;
+		else if (what == DEX_DIFF_FIELD)
+			cmp = compare_fields(a_dex, a->items[i].idx, b_dex, b->items[j].idx);
+		else
+			cmp = compare_methods(a_dex, a->items[i].idx, b_dex, b->items[j].idx);
+
+		if (cmp < 0) {
+			if (add_pending(state, DEX_DIFF_REMOVED, what, a->items[i].idx, NO_INDEX, 0) < 0)
+				return -1;
+			i++;
+		} else if (cmp > 0) {
+			if (add_pending(state, DEX_DIFF_ADDED, what, NO_INDEX, b->items[j].idx, 0) < 0)
+				return -1;
+			j++;
+		} else {
+			if (what == DEX_DIFF_FIELD)
+				reasons = a->items[i].access_flags != b->items[j].access_flags ? DEX_DIFF_FLAGS : 0;
+			else
+				reasons = method_reasons(state, &a->items[i], &b->items[j]);
+			if (reasons && add_pending(state, DEX_DIFF_CHANGED, what, a->items[i].idx, b->items[j].idx, reasons) < 0)
+				return -1;
+			i++;
+			j++;
+		}
+	}
+
+	return 0;
+}
+
+static int diff_class(diff_state *state, u4 old_idx, u4 new_idx)
+{
+	const dex_image *a = state->old_side.dex, *b = state->new_side.dex;
+	const class_def_struct *a_def = &a->class_defs[old_idx];
+	const class_def_struct *b_def = &b->class_defs[new_idx];
+	const u2 *a_ifaces, *b_ifaces;
+	dex_diff_entry entry;
+	u4 a_size, b_size, i, first;
+
+	entry.kind = DEX_DIFF_CHANGED;
+	entry.what = DEX_DIFF_CLASS;
+	entry.old_idx = old_idx;
+	entry.new_idx = new_idx;
+	entry.reasons = 0;
+
+	if (*a_def->access_flags != *b_def->access_flags)
+		entry.reasons |= DEX_DIFF_FLAGS;
+	if (compare_types(a, *a_def->superclass_idx, b, *b_def->superclass_idx))
+		entry.reasons |= DEX_DIFF_SUPERCLASS;
+
+	a_ifaces = dex_type_list(a, *a_def->interfaces_off, &a_size);
+	b_ifaces = dex_type_list(b, *b_def->interfaces_off, &b_size);
+	if (a_size != b_size) {
+		entry.reasons |= DEX_DIFF_INTERFACES;
+	} else {
+		for (i = 0; i < a_size; i++) {
+			if (compare_types(a, a_ifaces[i], b, b_ifaces[i])) {
+				entry.reasons |= DEX_DIFF_INTERFACES;
+				break;
+			}
+		}
+	}
+
+	if (collect_members(&state->old_side, a_def) < 0 || collect_members(&state->new_side, b_def) < 0)
+		return -1;
+
+	/* half collected members would all look removed */
+	if (a->budget && a->budget->status)
+		return 0;
+
+	state->pending_size = 0;
+	if (diff_members(state, DEX_DIFF_FIELD, &state->old_side.fields, &state->new_side.fields) < 0)
+		return -1;
+	first = state->pending_size;
+	if (first)
+		entry.reasons |= DEX_DIFF_FIELDS;
+	if (diff_members(state, DEX_DIFF_METHOD, &state->old_side.methods, &state->new_side.methods) < 0)
+		return -1;
+	if (state->pending_size > first)
+		entry.reasons |= DEX_DIFF_METHODS;
+
+	if (entry.reasons == 0)
+		return 0;
+
+	state->cb(a, b, &entry, state->ctx);
+	for (i = 0; i < state->pending_size; i++)
+		state->cb(a, b, &state->pending[i], state->ctx);
+
+	return 0;
+}
+
+static void report_class(diff_state *state, int kind, u4 old_idx, u4 new_idx)
+{
+	dex_diff_entry entry;
+
+	entry.kind = kind;
+	entry.what = DEX_DIFF_CLASS;
+	entry.old_idx = old_idx;
+	entry.new_idx = new_idx;
+	entry.reasons = 0;
+
+	state->cb(state->old_side.dex, state->new_side.dex, &entry, state->ctx);
+}
+
+static int side_init(diff_side *side, const dex_image *dex)
+{
+	u4 types = *dex->header->type_ids_size;
+	u4 c, type_idx;
+
+	memset(side, 0, sizeof(*side));
+	side->dex = dex;
+
+	side->class_of_type = dex_arena_alloc(dex->arena, (types ? types : 1) * sizeof(u4));
+	if (side->class_of_type == NULL || dex_hashes_init(dex, &side->hashes) < 0)
+		return -1;
+
+	memset(side->class_of_type, 0xff, (types ? types : 1) * sizeof(u4));	/* NO_INDEX */
+	for (c = 0; c < *dex->header->class_defs_size; c++) {
+		type_idx = *dex->class_defs[c].class_idx;
+		if (type_idx < types && side->class_of_type[type_idx] == NO_INDEX)
+			side->class_of_type[type_idx] = c;
+	}
+
+	return 0;
+}
+
+/*
+ * Report every class of old_dex missing from new_dex and the other way
+ * round, then for classes in both what changed in their flags, superclass,
+ * interfaces, fields and methods. Method bodies are compared by
+ * dex_code_hash(). Entries come in descriptor order. Returns -1 when out
+ * of memory, 0 also when the budget of old_dex stopped the comparison.
+ * Scratch space comes from the arenas of the two images.
+ */
+int dex_diff(const dex_image *old_dex, const dex_image *new_dex, dex_diff_cb cb, void *ctx)
+{
+	diff_state state;
+	u4 i = 0, j = 0, a_types, b_types, a_class, b_class;
+	int cmp;
+
+	memset(&state, 0, sizeof(state));
+	state.cb = cb;
+	state.ctx = ctx;
+
+	if (side_init(&state.old_side, old_dex) < 0 || side_init(&state.new_side, new_dex) < 0)
+		return -1;
+
+	a_types = *old_dex->header->type_ids_size;
+	b_types = *new_dex->header->type_ids_size;
+
+	while (i < a_types || j < b_types) {
+		/* new_dex is expected to share the budget of old_dex */
+		if (old_dex->budget && dex_budget_spend(old_dex, 1))
+			return 0;
+
+		if (i == a_types)
+			cmp = 1;
+		else if (j == b_types)
+			cmp = -1;
+		else
+			cmp = compare_types(old_dex, i, new_dex, j);
+
+		a_class = cmp <= 0 ? state.old_side.class_of_type[i] : NO_INDEX;
+		b_class = cmp >= 0 ? state.new_side.class_of_type[j] : NO_INDEX;
+
+		if (a_class != NO_INDEX && b_class != NO_INDEX) {
+			if (diff_class(&state, a_class, b_class) < 0)
+				return -1;
+		} else if (a_class != NO_INDEX) {
+			report_class(&state, DEX_DIFF_REMOVED, a_class, NO_INDEX);
+		} else if (b_class != NO_INDEX) {
+			report_class(&state, DEX_DIFF_ADDED, NO_INDEX, b_class);
+		}
+
+		if (cmp <= 0)
+			i++;
+		if (cmp >= 0)
+			j++;
+	}
+
+	return 0;
+}
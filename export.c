@@ -0,0 +1,537 @@
+/*
+ * dexinfo - a very rudimentary dex file parser
+ *
+ * Copyright (C) 2014 Keith Makan (@k3170Makan)
+ * Copyright (C) 2012-2013 Pau Oliva Fora (@pof)
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * -E: the class, field and method tables of a dex, resolved and written
+ * column by column so that a loader can map the file and read one column
+ * without touching the others. Everything is little endian and every
+ * section starts on an 8 byte boundary:
+ *
+ *	dex_export_header	magic "dexcol\n\0", version, offsets below
+ *	dex_export_table[]	classes, fields, methods
+ *	dex_export_column[]	the columns of every table, table by table
+ *	column data		one block per column, at dex_export_column.off
+ *	dictionary		u4 count, u4 offsets[count + 1], string bytes
+ *
+ * String columns hold ids into the dictionary, which every string column
+ * of the file shares. String i is at offsets[i] from the end of the
+ * offsets array, NUL terminated, and is offsets[i + 1] - offsets[i] - 1
+ * bytes long, MUTF-8 as in the dex. Id 0 is the empty string and stands
+ * for no string (a class without superclass or source file).
+ *
+ * Integer and string columns are either DEX_EXPORT_FIXED, rows values of
+ * width bytes (1, 2 or 4, the smallest that fits), or DEX_EXPORT_DELTA,
+ * the ULEB128 difference of every value from the one before it, the first
+ * from 0. Delta encoding is only used for columns that never decrease and
+ * come out smaller that way, like the class column of fields and methods.
+ *
+ *	classes: descriptor, superclass, source_file (strings), access_flags,
+ *		 static_fields, instance_fields, direct_methods, virtual_methods
+ *	fields:	 class (row in classes), name, type (strings), access_flags,
+ *		 kind (DEX_STATIC_FIELDS or DEX_INSTANCE_FIELDS)
+ *	methods: class (row in classes), name, proto (strings, "(ILjava/lang/String;)V"),
+ *		 access_flags, kind (DEX_DIRECT_METHODS or DEX_VIRTUAL_METHODS),
+ *		 code_size (insns_size in code units, 0 without code)
+ */
+
+#include <fnmatch.h>
+
+#include "dexinfo.h"
+
+#define ALIGN8(n)	(((n) + 7) & ~(u8)7)
+
+/* column values while the tables are built, one u4 per row */
+typedef struct {
+	const char *name;
+	int strings;
+	u4 *values;
+	u4 rows;
+	u4 alloc;
+	/* chosen when the file is laid out */
+	u1 encoding;
+	u1 width;
+	u8 off;
+	u8 size;
+} column;
+
+enum {
+	CLASS_DESCRIPTOR, CLASS_SUPERCLASS, CLASS_SOURCE_FILE, CLASS_ACCESS_FLAGS,
+	CLASS_STATIC_FIELDS, CLASS_INSTANCE_FIELDS, CLASS_DIRECT_METHODS, CLASS_VIRTUAL_METHODS,
+	FIELD_CLASS, FIELD_NAME, FIELD_TYPE, FIELD_ACCESS_FLAGS, FIELD_KIND,
+	METHOD_CLASS, METHOD_NAME, METHOD_PROTO, METHOD_ACCESS_FLAGS, METHOD_KIND, METHOD_CODE_SIZE,
+	COLUMNS
+};
+
+static const struct {
+	const char *name;
+	u4 first;
+	u4 count;
+} tables[DEX_EXPORT_TABLES] = {
+	{ "classes", CLASS_DESCRIPTOR, FIELD_CLASS - CLASS_DESCRIPTOR },
+	{ "fields", FIELD_CLASS, METHOD_CLASS - FIELD_CLASS },
+	{ "methods", METHOD_CLASS, COLUMNS - METHOD_CLASS },
+};
+
+static const struct {
+	const char *name;
+	int strings;
+} column_defs[COLUMNS] = {
+	{ "descriptor", 1 }, { "superclass", 1 }, { "source_file", 1 }, { "access_flags", 0 },
+	{ "static_fields", 0 }, { "instance_fields", 0 }, { "direct_methods", 0 }, { "virtual_methods", 0 },
+	{ "class", 0 }, { "name", 1 }, { "type", 1 }, { "access_flags", 0 }, { "kind", 0 },
+	{ "class", 0 }, { "name", 1 }, { "proto", 1 }, { "access_flags", 0 }, { "kind", 0 }, { "code_size", 0 },
+};
+
+/* a dictionary string, pointing into the image or into the arena */
+typedef struct {
+	const char *str;
+	u4 len;
+	u8 hash;
+} dict_entry;
+
+typedef struct {
+	const char *class_filter;
+	dex_arena *arena;
+	column columns[COLUMNS];
+	dict_entry *entries;	/* by id, entries[0] is the empty string */
+	u4 count;
+	u4 alloc;
+	u4 *slots;		/* open addressing, id + 1, 0 when free */
+	u4 mask;
+	u4 *string_ids;		/* per string_idx, 0 until interned */
+	u4 *proto_ids;		/* per proto_idx, 0 until interned */
+	u8 dict_bytes;
+	int failed;
+} export_ctx;
+
+static void append(export_ctx *ctx, int col, u4 value)
+{
+	column *c = &ctx->columns[col];
+	u4 *values;
+	u4 alloc;
+
+	if (c->rows == c->alloc) {
+		alloc = c->alloc ? c->alloc * 2 : 256;
+		values = dex_arena_grow(ctx->arena, c->values, (size_t)c->alloc * sizeof(u4), (size_t)alloc * sizeof(u4));
+		if (values == NULL) {
+			ctx->failed = 1;
+			return;
+		}
+		c->values = values;
+		c->alloc = alloc;
+	}
+
+	c->values[c->rows++] = value;
+}
+
+static int grow_dict(export_ctx *ctx)
+{
+	u4 i, slot, size = (ctx->mask + 1) * 2;
+	u4 *slots = dex_arena_calloc(ctx->arena, size, sizeof(u4));
+
+	if (slots == NULL)
+		return -1;
+
+	for (i = 1; i < ctx->count; i++) {
+		slot = ctx->entries[i].hash & (size - 1);
+		while (slots[slot])
+			slot = (slot + 1) & (size - 1);
+		slots[slot] = i + 1;
+	}
+
+	ctx->slots = slots;
+	ctx->mask = size - 1;
+	return 0;
+}
+
+/* dictionary id of a string, 0 on failure */
+static u4 intern(export_ctx *ctx, const char *str, u4 len)
+{
+	dict_entry *entry;
+	u8 hash = dex_hash(str, len, 0);
+	u4 slot = hash & ctx->mask, id;
+
+	if (len == 0)
+		return 0;
+
+	while ((id = ctx->slots[slot]) != 0) {
+		entry = &ctx->entries[id - 1];
+		if (entry->hash == hash && entry->len == len && memcmp(entry->str, str, len) == 0)
+			return id - 1;
+		slot = (slot + 1) & ctx->mask;
+	}
+
+	if (ctx->count == ctx->alloc) {
+		entry = dex_arena_grow(ctx->arena, ctx->entries, (size_t)ctx->alloc * sizeof(dict_entry),
+			(size_t)ctx->alloc * 2 * sizeof(dict_entry));
+		if (entry == NULL) {
+			ctx->failed = 1;
+			return 0;
+		}
+		ctx->entries = entry;
+		ctx->alloc *= 2;
+	}
+
+	id = ctx->count++;
+	entry = &ctx->entries[id];
+	entry->str = str;
+	entry->len = len;
+	entry->hash = hash;
+	ctx->slots[slot] = id + 1;
+	ctx->dict_bytes += len + 1;
+
+	/* kept at most half full */
+	if (ctx->count * 2 > ctx->mask && grow_dict(ctx) < 0)
+		ctx->failed = 1;
+
+	return id;
+}
+
+static u4 string_id(export_ctx *ctx, const dex_image *dex, u4 string_idx)
+{
+	const char *str;
+
+	if (string_idx >= *dex->header->string_ids_size)
+		return 0;
+	if (ctx->string_ids[string_idx] == 0) {
+		str = dex_string(dex, string_idx);
+		if (str)
+			ctx->string_ids[string_idx] = intern(ctx, str, strlen(str));
+	}
+
+	return ctx->string_ids[string_idx];
+}
+
+static u4 type_id(export_ctx *ctx, const dex_image *dex, u4 type_idx)
+{
+	if (type_idx >= *dex->header->type_ids_size)
+		return 0;
+
+	return string_id(ctx, dex, *dex->type_ids[type_idx].descriptor_idx);
+}
+
+/* protos are spelled out as a method descriptor, built once per proto_idx */
+static u4 proto_id(export_ctx *ctx, const dex_image *dex, u4 proto_idx)
+{
+	const proto_id_struct *proto;
+	const char *desc[2];
+	const u2 *params;
+	char *buf;
+	size_t len, l;
+	u4 i, n;
+
+	if (proto_idx >= *dex->header->proto_ids_size)
+		return 0;
+	if (ctx->proto_ids[proto_idx])
+		return ctx->proto_ids[proto_idx];
+
+	proto = &dex->proto_ids[proto_idx];
+	params = dex_type_list(dex, *proto->parameters_off, &n);
+
+	len = 2;
+	for (i = 0; i < n; i++) {
+		desc[0] = dex_type_desc(dex, params[i]);
+		len += desc[0] ? strlen(desc[0]) : 0;
+	}
+	desc[1] = dex_type_desc(dex, *proto->return_type_idx);
+	len += desc[1] ? strlen(desc[1]) : 0;
+
+	buf = dex_arena_alloc(ctx->arena, len + 1);
+	if (buf == NULL) {
+		ctx->failed = 1;
+		return 0;
+	}
+
+	len = 0;
+	buf[len++] = '(';
+	for (i = 0; i < n; i++) {
+		desc[0] = dex_type_desc(dex, params[i]);
+		if (desc[0]) {
+			l = strlen(desc[0]);
+			memcpy(buf + len, desc[0], l);
+			len += l;
+		}
+	}
+	buf[len++] = ')';
+	if (desc[1]) {
+		l = strlen(desc[1]);
+		memcpy(buf + len, desc[1], l);
+		len += l;
+	}
+	buf[len] = '\0';
+
+	ctx->proto_ids[proto_idx] = intern(ctx, buf, len);
+	return ctx->proto_ids[proto_idx];
+}
+
+static int export_class(const dex_image *dex, const dex_class *cls, void *arg)
+{
+	export_ctx *ctx = arg;
+	const class_def_struct *class_def = cls->class_def;
+	const char *desc;
+	int kind;
+
+	if (ctx->failed)
+		return 1;
+
+	if (ctx->class_filter) {
+		desc = dex_type_desc(dex, *class_def->class_idx);
+		if (desc == NULL || fnmatch(ctx->class_filter, desc, 0) != 0)
+			return 1;
+	}
+
+	append(ctx, CLASS_DESCRIPTOR, type_id(ctx, dex, *class_def->class_idx));
+	append(ctx, CLASS_SUPERCLASS, type_id(ctx, dex, *class_def->superclass_idx));
+	append(ctx, CLASS_SOURCE_FILE, string_id(ctx, dex, *class_def->source_file_idx));
+	append(ctx, CLASS_ACCESS_FLAGS, *class_def->access_flags);
+	for (kind = DEX_STATIC_FIELDS; kind <= DEX_VIRTUAL_METHODS; kind++)
+		append(ctx, CLASS_STATIC_FIELDS + kind, cls->counts[kind]);
+
+	return 0;
+}
+
+static void export_field(const dex_image *dex, const dex_class *cls, const dex_field *field, void *arg)
+{
+	export_ctx *ctx = arg;
+	const field_id_struct *field_id = NULL;
+
+	if (field->field_idx < *dex->header->field_ids_size)
+		field_id = &dex->field_ids[field->field_idx];
+
+	append(ctx, FIELD_CLASS, ctx->columns[CLASS_DESCRIPTOR].rows - 1);
+	append(ctx, FIELD_NAME, field_id ? string_id(ctx, dex, *field_id->name_idx) : 0);
+	append(ctx, FIELD_TYPE, field_id ? type_id(ctx, dex, *field_id->type_idx) : 0);
+	append(ctx, FIELD_ACCESS_FLAGS, field->access_flags);
+	append(ctx, FIELD_KIND, field->kind);
+}
+
+static void export_method(const dex_image *dex, const dex_class *cls, const dex_method *method, void *arg)
+{
+	export_ctx *ctx = arg;
+	const method_id_struct *method_id = NULL;
+	const code_item_struct *code = NULL;
+
+	if (method->method_idx < *dex->header->method_ids_size)
+		method_id = &dex->method_ids[method->method_idx];
+	if (method->code_off)
+		code = dex_code_item(dex, method->code_off);
+
+	append(ctx, METHOD_CLASS, ctx->columns[CLASS_DESCRIPTOR].rows - 1);
+	append(ctx, METHOD_NAME, method_id ? string_id(ctx, dex, *method_id->name_idx) : 0);
+	append(ctx, METHOD_PROTO, method_id ? proto_id(ctx, dex, *method_id->proto_idx) : 0);
+	append(ctx, METHOD_ACCESS_FLAGS, method->access_flags);
+	append(ctx, METHOD_KIND, method->kind);
+	append(ctx, METHOD_CODE_SIZE, code ? *code->insns_size : 0);
+}
+
+static const dex_visitor export_visitor = {
+	NULL, export_class, NULL, export_field, export_method, .flags = DEX_VISIT_COUNTS
+};
+
+/* fixed width or delta, whichever is smaller, delta only for columns that never decrease */
+static void choose_encoding(column *c)
+{
+	u4 i, max = 0, prev = 0;
+	u8 delta = 0;
+	int sorted = 1;
+
+	for (i = 0; i < c->rows; i++) {
+		if (c->values[i] > max)
+			max = c->values[i];
+		if (c->values[i] < prev)
+			sorted = 0;
+		else
+			delta += len_uleb128(c->values[i] - prev);
+		prev = c->values[i];
+	}
+
+	c->encoding = DEX_EXPORT_FIXED;
+	c->width = max > 0xffff ? 4 : max > 0xff ? 2 : 1;
+	c->size = (u8)c->rows * c->width;
+
+	if (sorted && !c->strings && delta < c->size) {
+		c->encoding = DEX_EXPORT_DELTA;
+		c->width = 0;
+		c->size = delta;
+	}
+}
+
+static void write_uleb128(u4 value, FILE *out)
+{
+	u1 byte;
+
+	do {
+		byte = value & 0x7f;
+		value >>= 7;
+		if (value)
+			byte |= 0x80;
+		fputc(byte, out);
+	} while (value);
+}
+
+static void write_column(const column *c, FILE *out)
+{
+	u4 i, prev = 0;
+	u1 le[4];
+
+	for (i = 0; i < c->rows; i++) {
+		if (c->encoding == DEX_EXPORT_DELTA) {
+			write_uleb128(c->values[i] - prev, out);
+			prev = c->values[i];
+			continue;
+		}
+		le[0] = c->values[i];
+		le[1] = c->values[i] >> 8;
+		le[2] = c->values[i] >> 16;
+		le[3] = c->values[i] >> 24;
+		fwrite(le, c->width, 1, out);
+	}
+}
+
+static void write_padding(u8 pos, FILE *out)
+{
+	static const u1 zeros[8];
+
+	fwrite(zeros, ALIGN8(pos) - pos, 1, out);
+}
+
+static void write_u4(u4 value, FILE *out)
+{
+	u1 le[4] = { value, value >> 8, value >> 16, value >> 24 };
+
+	fwrite(le, sizeof(le), 1, out);
+}
+
+static void write_u8(u8 value, FILE *out)
+{
+	write_u4(value, out);
+	write_u4(value >> 32, out);
+}
+
+/*
+ * Write the tables of dex to out, classes whose descriptor does not match
+ * class_filter left out. rows gets the row count of every table. Returns
+ * -1 when out of memory, when out could not be written or when the budget
+ * of dex ran out, since a file with some of the rows would pass for whole.
+ */
+int dex_export(const dex_image *dex, const char *class_filter, FILE *out, u4 *rows)
+{
+	export_ctx ctx;
+	column *c;
+	char name[DEX_EXPORT_NAME];
+	u8 pos, dict_off;
+	u4 i, t, off;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.class_filter = class_filter;
+	ctx.arena = dex->arena;
+	for (i = 0; i < COLUMNS; i++) {
+		ctx.columns[i].name = column_defs[i].name;
+		ctx.columns[i].strings = column_defs[i].strings;
+	}
+
+	ctx.alloc = 1024;
+	ctx.count = 1;
+	ctx.mask = 2047;
+	ctx.entries = dex_arena_calloc(ctx.arena, ctx.alloc, sizeof(dict_entry));
+	ctx.slots = dex_arena_calloc(ctx.arena, ctx.mask + 1, sizeof(u4));
+	ctx.string_ids = dex_arena_calloc(ctx.arena, *dex->header->string_ids_size + 1, sizeof(u4));
+	ctx.proto_ids = dex_arena_calloc(ctx.arena, *dex->header->proto_ids_size + 1, sizeof(u4));
+	if (!ctx.entries || !ctx.slots || !ctx.string_ids || !ctx.proto_ids)
+		return -1;
+	ctx.entries[0].str = "";
+	ctx.dict_bytes = 1;
+
+	dex_visit(dex, &export_visitor, &ctx);
+	if (ctx.failed || (dex->budget && dex->budget->status))
+		return -1;
+
+	/* lay the file out */
+	pos = sizeof(dex_export_header) + DEX_EXPORT_TABLES * sizeof(dex_export_table) +
+		COLUMNS * sizeof(dex_export_column);
+	for (i = 0; i < COLUMNS; i++) {
+		c = &ctx.columns[i];
+		choose_encoding(c);
+		c->off = pos;
+		pos = ALIGN8(pos + c->size);
+	}
+	dict_off = pos;
+
+	/* header */
+	fwrite(DEX_EXPORT_MAGIC, 8, 1, out);
+	write_u4(DEX_EXPORT_VERSION, out);
+	write_u4(DEX_EXPORT_TABLES, out);
+	write_u4(COLUMNS, out);
+	write_u4(sizeof(dex_export_header), out);
+	write_u4(sizeof(dex_export_header) + DEX_EXPORT_TABLES * sizeof(dex_export_table), out);
+	write_u4(dict_off, out);
+
+	for (t = 0; t < DEX_EXPORT_TABLES; t++) {
+		memset(name, 0, sizeof(name));
+		strncpy(name, tables[t].name, sizeof(name) - 1);
+		fwrite(name, sizeof(name), 1, out);
+		rows[t] = ctx.columns[tables[t].first].rows;
+		write_u4(rows[t], out);
+		write_u4(tables[t].first, out);
+		write_u4(tables[t].count, out);
+		write_u4(0, out);
+	}
+
+	for (t = 0; t < DEX_EXPORT_TABLES; t++) {
+		for (i = tables[t].first; i < tables[t].first + tables[t].count; i++) {
+			c = &ctx.columns[i];
+			memset(name, 0, sizeof(name));
+			strncpy(name, c->name, sizeof(name) - 1);
+			fwrite(name, sizeof(name), 1, out);
+			fputc(c->encoding, out);
+			fputc(c->width, out);
+			fputc(c->strings, out);
+			fputc(t, out);
+			write_u4(c->rows, out);
+			write_u8(c->off, out);
+			write_u8(c->size, out);
+		}
+	}
+
+	/* the writer checks the budget too, a large file takes a while to write */
+	for (i = 0; i < COLUMNS; i++) {
+		if (dex->budget && dex_budget_spend(dex, 0))
+			return -1;
+		c = &ctx.columns[i];
+		write_column(c, out);
+		write_padding(c->off + c->size, out);
+	}
+
+	/* dictionary */
+	write_u4(ctx.count, out);
+	for (i = 0, off = 0; i < ctx.count; i++) {
+		write_u4(off, out);
+		off += ctx.entries[i].len + 1;
+	}
+	write_u4(off, out);
+	for (i = 0; i < ctx.count; i++) {
+		if (dex->budget && dex_budget_spend(dex, 0))
+			return -1;
+		fwrite(ctx.entries[i].str, ctx.entries[i].len + 1, 1, out);
+	}
+	write_padding(dict_off + sizeof(u4) * (ctx.count + 2) + ctx.dict_bytes, out);
+
+	return ferror(out) ? -1 : 0;
+}
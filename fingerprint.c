@@ -0,0 +1,309 @@
+/*
+ * dexinfo - a very rudimentary dex file parser
+ *
+ * Copyright (C) 2014 Keith Makan (@k3170Makan)
+ * Copyright (C) 2012-2013 Pau Oliva Fora (@pof)
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Bytecode fingerprints, for finding the same routine in unrelated apps.
+ * Unlike dex_code_hash(), which tells whether a method changed between two
+ * builds, a fingerprint leaves out what renaming, register allocation and
+ * the layout of the constant pools change:
+ *
+ *  - registers are renumbered in the order the method first uses them,
+ *  - string, type, field, method and proto operands only count by kind,
+ *    except types and members of the platform (java, javax, android,
+ *    dalvik), which no obfuscator renames and which are hashed by name,
+ *  - opcodes, literals, branch offsets, payloads and try ranges are kept.
+ *
+ * Each instruction is rewritten into a scratch buffer with those fields
+ * cleared, followed by its normalized operands, and the buffer is hashed
+ * with dex_hash() in one go.
+ */
+
+#include "dexinfo.h"
+
+/* what an instruction can add to the buffer: 255 range registers and an index */
+#define MAX_TOKENS	(256 + 8)
+
+#define PLATFORM_UNKNOWN	0
+#define PLATFORM_YES		1
+#define PLATFORM_NO		2
+
+int dex_fingerprint_init(const dex_image *dex, dex_fingerprint *fp)
+{
+	memset(fp, 0, sizeof(*fp));
+
+	if (dex_hashes_init(dex, &fp->hashes) < 0)
+		return -1;
+
+	fp->platform = dex_arena_calloc(dex->arena, *dex->header->type_ids_size + 1, 1);
+	return fp->platform ? 0 : -1;
+}
+
+static int is_platform(dex_fingerprint *fp, u4 type_idx)
+{
+	static const char *prefixes[] = { "Ljava/", "Ljavax/", "Landroid/", "Ldalvik/" };
+	const dex_image *dex = fp->hashes.dex;
+	const char *desc;
+	u4 i;
+
+	if (type_idx >= *dex->header->type_ids_size)
+		return 0;
+
+	if (fp->platform[type_idx] == PLATFORM_UNKNOWN) {
+		fp->platform[type_idx] = PLATFORM_NO;
+		desc = dex_type_desc(dex, type_idx);
+		while (desc && *desc == '[')
+			desc++;
+		/* primitives are the same everywhere */
+		if (desc && desc[0] != 'L' && desc[0] != '\0')
+			fp->platform[type_idx] = PLATFORM_YES;
+		for (i = 0; desc && i < sizeof(prefixes) / sizeof(prefixes[0]); i++) {
+			if (strncmp(desc, prefixes[i], strlen(prefixes[i])) == 0)
+				fp->platform[type_idx] = PLATFORM_YES;
+		}
+	}
+
+	return fp->platform[type_idx] == PLATFORM_YES;
+}
+
+/* what an index operand contributes */
+static u8 index_token(dex_fingerprint *fp, int index_kind, u4 index)
+{
+	const dex_image *dex = fp->hashes.dex;
+
+	switch (index_kind) {
+	case INDEX_TYPE:
+		if (is_platform(fp, index))
+			return dex_type_hash(&fp->hashes, index);
+		break;
+	case INDEX_FIELD:
+		if (index < *dex->header->field_ids_size && is_platform(fp, *dex->field_ids[index].class_idx))
+			return dex_field_hash(&fp->hashes, index);
+		break;
+	case INDEX_METHOD:
+		if (index < *dex->header->method_ids_size && is_platform(fp, *dex->method_ids[index].class_idx))
+			return dex_method_hash(&fp->hashes, index);
+		break;
+	}
+
+	return index_kind;
+}
+
+/* canonical number of a register, in order of first use in the method */
+static u2 canonical(dex_fingerprint *fp, u4 reg)
+{
+	if (reg >= fp->regs_alloc)
+		return 0xffff;
+
+	if (fp->seen[reg] != fp->stamp) {
+		fp->seen[reg] = fp->stamp;
+		fp->canon[reg] = fp->next_reg++;
+	}
+
+	return fp->canon[reg];
+}
+
+/*
+ * Clear the register fields of the instruction copied to units and return
+ * them in regs, in operand order.
+ */
+static u4 take_registers(const dex_insn *insn, u2 *units, u4 *regs)
+{
+	u4 n = 0, i, count;
+
+	switch (insn->format) {
+	case FMT_12x:
+	case FMT_22t:
+	case FMT_22s:
+	case FMT_22c:
+		regs[n++] = (units[0] >> 8) & 0xf;
+		regs[n++] = units[0] >> 12;
+		units[0] &= 0x00ff;
+		break;
+	case FMT_11n:
+		regs[n++] = (units[0] >> 8) & 0xf;
+		units[0] &= 0xf0ff;
+		break;
+	case FMT_11x:
+	case FMT_21t:
+	case FMT_21s:
+	case FMT_21h:
+	case FMT_21c:
+	case FMT_31t:
+	case FMT_31i:
+	case FMT_31c:
+	case FMT_51l:
+		regs[n++] = units[0] >> 8;
+		units[0] &= 0x00ff;
+		break;
+	case FMT_22x:
+		regs[n++] = units[0] >> 8;
+		regs[n++] = units[1];
+		units[0] &= 0x00ff;
+		units[1] = 0;
+		break;
+	case FMT_23x:
+		regs[n++] = units[0] >> 8;
+		regs[n++] = units[1] & 0xff;
+		regs[n++] = units[1] >> 8;
+		units[0] &= 0x00ff;
+		units[1] = 0;
+		break;
+	case FMT_22b:
+		regs[n++] = units[0] >> 8;
+		regs[n++] = units[1] & 0xff;
+		units[0] &= 0x00ff;
+		units[1] &= 0xff00;
+		break;
+	case FMT_32x:
+		regs[n++] = units[1];
+		regs[n++] = units[2];
+		units[1] = units[2] = 0;
+		break;
+	case FMT_35c:
+	case FMT_45cc:
+		/* argument count in A, registers C, D, E, F then G */
+		count = units[0] >> 12;
+		for (i = 0; i < count && i < 4; i++)
+			regs[n++] = (units[2] >> (i * 4)) & 0xf;
+		if (count == 5)
+			regs[n++] = (units[0] >> 8) & 0xf;
+		units[0] &= 0xf0ff;
+		units[2] = 0;
+		break;
+	case FMT_3rc:
+	case FMT_4rcc:
+		count = units[0] >> 8;
+		for (i = 0; i < count; i++)
+			regs[n++] = units[2] + i;
+		units[2] = 0;
+		break;
+	}
+
+	return n;
+}
+
+static int reserve_units(dex_fingerprint *fp, u4 n)
+{
+	u2 *units;
+	u4 alloc;
+
+	if (fp->size + n <= fp->alloc)
+		return 0;
+
+	alloc = fp->alloc ? fp->alloc : 1024;
+	while (alloc < fp->size + n)
+		alloc *= 2;
+	units = dex_arena_grow(fp->hashes.dex->arena, fp->units, (size_t)fp->alloc * sizeof(u2), (size_t)alloc * sizeof(u2));
+	if (units == NULL)
+		return -1;
+
+	fp->units = units;
+	fp->alloc = alloc;
+	return 0;
+}
+
+/* catch types as any other type operand */
+static u8 catch_token(void *ctx, u4 type_idx)
+{
+	return index_token(ctx, INDEX_TYPE, type_idx);
+}
+
+/* fingerprint of a code_item, 0 when out of memory */
+u8 dex_method_fingerprint(dex_fingerprint *fp, const code_item_struct *code)
+{
+	const dex_image *dex = fp->hashes.dex;
+	dex_insn insn;
+	u4 regs[MAX_TOKENS];
+	u4 pc = 0, i, n, regs_size = *code->registers_size;
+	u2 *units;
+	u8 token, h;
+
+	if (regs_size > fp->regs_alloc) {
+		fp->seen = dex_arena_calloc(dex->arena, (size_t)regs_size * 2, sizeof(u4));
+		if (fp->seen == NULL)
+			return 0;
+		fp->canon = fp->seen + regs_size;
+		fp->regs_alloc = regs_size;
+	}
+	/* a new stamp forgets the numbering of the previous method */
+	fp->stamp++;
+	fp->next_reg = 0;
+	fp->size = 0;
+
+	while (pc < *code->insns_size) {
+		if (dex_insn_decode(code, pc, &insn) < 0) {
+			/* truncated, take the rest as it is */
+			n = *code->insns_size - pc;
+			if (reserve_units(fp, n) < 0)
+				return 0;
+			memcpy(fp->units + fp->size, code->insns + pc, n * sizeof(u2));
+			fp->size += n;
+			break;
+		}
+
+		if (reserve_units(fp, insn.width + MAX_TOKENS) < 0)
+			return 0;
+		units = fp->units + fp->size;
+		memcpy(units, insn.insn, insn.width * sizeof(u2));
+		fp->size += insn.width;
+
+		if (insn.format == FMT_PAYLOAD) {
+			pc += insn.width;
+			continue;
+		}
+
+		n = take_registers(&insn, units, regs);
+		if (insn.index_kind != INDEX_NONE) {
+			units[1] = 0;
+			if (insn.format == FMT_31c)
+				units[2] = 0;
+			if (insn.format == FMT_45cc || insn.format == FMT_4rcc)
+				units[3] = 0;
+		}
+
+		for (i = 0; i < n; i++)
+			fp->units[fp->size++] = canonical(fp, regs[i]);
+
+		if (insn.index_kind != INDEX_NONE) {
+			token = index_token(fp, insn.index_kind, insn.index);
+			memcpy(fp->units + fp->size, &token, sizeof(token));
+			fp->size += sizeof(token) / sizeof(u2);
+		}
+
+		pc += insn.width;
+	}
+
+	h = dex_hash(fp->units, (size_t)fp->size * sizeof(u2), *code->ins_size);
+	if (*code->tries_size)
+		h = dex_tries_hash(dex, code, h, catch_token, fp);
+
+	/* 0 is kept for errors */
+	return h ? h : 1;
+}
+
+/*
+ * Add a method to the fingerprint of its class, which starts at 0. The
+ * methods are combined in any order, since renaming them changes their
+ * order in class_data.
+ */
+u8 dex_class_fingerprint(u8 class_fp, u8 method_fp)
+{
+	return class_fp + dex_hash_mix(0, method_fp);
+}
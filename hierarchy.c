@@ -0,0 +1,211 @@
+/*
+ * dexinfo - a very rudimentary dex file parser
+ *
+ * Copyright (C) 2014 Keith Makan (@k3170Makan)
+ * Copyright (C) 2012-2013 Pau Oliva Fora (@pof)
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Class hierarchy index built from superclass_idx and interfaces_off in a
+ * single pass over class_defs. Queries walk the adjacency lists and stamp
+ * the classes they reach, so they cost what they return and survive the
+ * cycles a broken or hostile dex may contain.
+ */
+
+#include "dexinfo.h"
+
+static u4 * alloc_index(dex_arena *arena, size_t n)
+{
+	u4 *index = dex_arena_alloc(arena, (n ? n : 1) * sizeof(u4));
+
+	if (index)
+		memset(index, 0xff, (n ? n : 1) * sizeof(u4));	/* NO_INDEX */
+
+	return index;
+}
+
+static int add_implementor(dex_arena *arena, dex_hierarchy *hierarchy, u4 type_idx, u4 class_def_idx)
+{
+	dex_hierarchy_edge *impl;
+	u4 alloc;
+
+	if (hierarchy->impl_size == hierarchy->impl_alloc) {
+		alloc = hierarchy->impl_alloc ? hierarchy->impl_alloc * 2 : 256;
+		impl = dex_arena_grow(arena, hierarchy->impl, hierarchy->impl_alloc * sizeof(*impl), alloc * sizeof(*impl));
+		if (impl == NULL)
+			return -1;
+		hierarchy->impl = impl;
+		hierarchy->impl_alloc = alloc;
+	}
+
+	impl = &hierarchy->impl[hierarchy->impl_size];
+	impl->class_def_idx = class_def_idx;
+	impl->next = hierarchy->impl_head[type_idx];
+	hierarchy->impl_head[type_idx] = hierarchy->impl_size++;
+
+	return 0;
+}
+
+/*
+ * Index the superclass and interfaces of every class of dex. Returns -1
+ * when out of memory, 0 also when the budget of dex stopped the build,
+ * leaving an index that must not be queried.
+ */
+int dex_hierarchy_build(const dex_image *dex, dex_hierarchy *hierarchy)
+{
+	const class_def_struct *class_def;
+	const u2 *interfaces;
+	u4 c, i, n, type_idx, super_idx;
+
+	memset(hierarchy, 0, sizeof(*hierarchy));
+	hierarchy->types = *dex->header->type_ids_size;
+	hierarchy->classes = *dex->header->class_defs_size;
+
+	hierarchy->class_of_type = alloc_index(dex->arena, hierarchy->types);
+	hierarchy->child_head = alloc_index(dex->arena, hierarchy->types);
+	hierarchy->impl_head = alloc_index(dex->arena, hierarchy->types);
+	hierarchy->child_next = alloc_index(dex->arena, hierarchy->classes);
+	hierarchy->stack = alloc_index(dex->arena, hierarchy->classes);
+	hierarchy->seen = dex_arena_calloc(dex->arena, hierarchy->classes ? hierarchy->classes : 1, sizeof(u4));
+
+	if (!hierarchy->class_of_type || !hierarchy->child_head || !hierarchy->impl_head ||
+	    !hierarchy->child_next || !hierarchy->stack || !hierarchy->seen)
+		return -1;
+
+	/* walked backwards so that the lists, built by prepending, come out in class_def order */
+	for (c = hierarchy->classes; c-- > 0; ) {
+		if (dex->budget && dex_budget_spend(dex, 1))
+			return 0;
+
+		class_def = &dex->class_defs[c];
+		type_idx = *class_def->class_idx;
+		super_idx = *class_def->superclass_idx;
+
+		if (type_idx < hierarchy->types)
+			hierarchy->class_of_type[type_idx] = c;
+
+		if (super_idx < hierarchy->types) {
+			hierarchy->child_next[c] = hierarchy->child_head[super_idx];
+			hierarchy->child_head[super_idx] = c;
+		}
+
+		interfaces = dex_type_list(dex, *class_def->interfaces_off, &n);
+		for (i = n; i-- > 0; ) {
+			if (dex->budget && dex_budget_spend(dex, 0))
+				return 0;
+			if (interfaces[i] < hierarchy->types && add_implementor(dex->arena, hierarchy, interfaces[i], c) < 0)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void next_stamp(dex_hierarchy *hierarchy)
+{
+	if (++hierarchy->stamp == 0) {
+		memset(hierarchy->seen, 0, hierarchy->classes * sizeof(u4));
+		hierarchy->stamp = 1;
+	}
+}
+
+/* push class_def c unless this query has already been there */
+static void visit(const dex_image *dex, dex_hierarchy *hierarchy, u4 c, u4 *top, int *found,
+		dex_hierarchy_cb cb, void *ctx)
+{
+	if (hierarchy->seen[c] == hierarchy->stamp)
+		return;
+
+	hierarchy->seen[c] = hierarchy->stamp;
+	hierarchy->stack[(*top)++] = c;
+	(*found)++;
+
+	if (cb)
+		cb(dex, *dex->class_defs[c].class_idx, c, ctx);
+}
+
+/*
+ * Report the classes extending (DEX_HIERARCHY_SUBCLASSES) and/or
+ * implementing (DEX_HIERARCHY_IMPLEMENTORS) type_idx, transitively unless
+ * DEX_HIERARCHY_DIRECT is set. Interfaces extending an interface are
+ * listed in its interfaces_off, so with both flags the walk finds every
+ * class that can be used as type_idx. Returns the number of classes.
+ */
+int dex_hierarchy_descendants(const dex_image *dex, dex_hierarchy *hierarchy, u4 type_idx, int flags,
+		dex_hierarchy_cb cb, void *ctx)
+{
+	u4 top = 0, bottom = 0, c, e, t;
+	int found = 0;
+
+	if (type_idx >= hierarchy->types)
+		return 0;
+
+	next_stamp(hierarchy);
+
+	t = type_idx;
+	for (;;) {
+		if (flags & DEX_HIERARCHY_SUBCLASSES)
+			for (c = hierarchy->child_head[t]; c != NO_INDEX; c = hierarchy->child_next[c])
+				visit(dex, hierarchy, c, &top, &found, cb, ctx);
+
+		if (flags & DEX_HIERARCHY_IMPLEMENTORS)
+			for (e = hierarchy->impl_head[t]; e != NO_INDEX; e = hierarchy->impl[e].next)
+				visit(dex, hierarchy, hierarchy->impl[e].class_def_idx, &top, &found, cb, ctx);
+
+		if (flags & DEX_HIERARCHY_DIRECT)
+			return found;
+
+		/* breadth first, the stack doubles as the queue */
+		do {
+			if (bottom == top)
+				return found;
+			t = *dex->class_defs[hierarchy->stack[bottom++]].class_idx;
+		} while (t >= hierarchy->types);
+	}
+}
+
+/*
+ * Report the superclass chain of type_idx, nearest first. The walk stops
+ * at the first type not defined in this dex, which is reported with a
+ * class_def_idx of NO_INDEX. Returns the length of the chain.
+ */
+int dex_hierarchy_ancestors(const dex_image *dex, dex_hierarchy *hierarchy, u4 type_idx,
+		dex_hierarchy_cb cb, void *ctx)
+{
+	u4 c, super_idx;
+	int found = 0;
+
+	if (type_idx >= hierarchy->types)
+		return 0;
+
+	next_stamp(hierarchy);
+
+	for (c = hierarchy->class_of_type[type_idx]; c != NO_INDEX; c = hierarchy->class_of_type[super_idx]) {
+		if (hierarchy->seen[c] == hierarchy->stamp)
+			break;
+		hierarchy->seen[c] = hierarchy->stamp;
+
+		super_idx = *dex->class_defs[c].superclass_idx;
+		if (super_idx >= hierarchy->types)
+			break;
+
+		found++;
+		if (cb)
+			cb(dex, super_idx, hierarchy->class_of_type[super_idx], ctx);
+	}
+
+	return found;
+}
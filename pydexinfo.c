@@ -25,7 +25,7 @@
 #include <stdbool.h>
 #include <python2.7/Python.h>
 
-char * dexinfo(char * dexfile, int DEBUG);
+#include "dexinfo.h"
 
 static PyObject * err_dexinfo;
 
@@ -90,9 +90,18 @@ static PyObject * pydexinfo_dexinfo(PyObject __attribute__((unused)) * self, PyO
 	PyObject *temp;
 	char * dexfile;
 	char * printbuf;
-	int verbose;
-
-	if (!PyArg_ParseTuple(args, "Ob", &temp, &verbose))
+	char * other_data = NULL;
+	int other_size = 0;
+	unsigned long memory_limit = 0;
+	char * output = NULL;
+	unsigned int time_limit = 0;
+	unsigned long item_limit = 0;
+	dexinfo_options opts;
+
+	memset(&opts, 0, sizeof(opts));
+
+	if (!PyArg_ParseTuple(args, "Oi|izzz#kzIk", &temp, &opts.verbose, &opts.mode, &opts.class_filter, &opts.type,
+			&other_data, &other_size, &memory_limit, &output, &time_limit, &item_limit))
 	{
 		PyErr_SetString(err_dexinfo, "Error parsing function arguments");
 
@@ -134,10 +143,18 @@ static PyObject * pydexinfo_dexinfo(PyObject __attribute__((unused)) * self, PyO
 		goto error;
 	}
 
+	/* the second dex of MODE_DIFF is passed as its contents */
+	opts.other_data = (u1 *)other_data;
+	opts.other_size = other_size;
+	opts.memory_limit = memory_limit;
+	opts.output = output;
+	opts.time_limit = time_limit;
+	opts.item_limit = item_limit;
+
 	/* Tell dexinfo it should call the read callback */
 	dexfile = NULL;
 
-	if ((printbuf = dexinfo(dexfile, verbose)) == NULL)
+	if ((printbuf = dexinfo(dexfile, &opts)) == NULL)
 	{
 		PyErr_SetString(err_dexinfo, "Error in dexinfo");
 
@@ -150,7 +167,7 @@ error:
 }
 
 static PyMethodDef dexinfo_methods[] = {
-	{"dexinfo", pydexinfo_dexinfo, 1, "dexinfo(dexfile, verbose = False)\nRun dexinfo processor"}
+	{"dexinfo", pydexinfo_dexinfo, 1, "dexinfo(dexfile, verbose, mode = MODE_FULL, class_filter = None, type_desc = None, other_data = None, memory_limit = 0, output = None, time_limit = 0, item_limit = 0)\nRun dexinfo processor"}
 };
 
 void initpydexinfo( void )
@@ -1,4 +1,23 @@
 from pydexinfo import *
+import mmap
+import struct
+
+# output projections, see DEXINFO_MODE_* in dexinfo.h
+MODE_FULL = 0
+MODE_HEADER = 1
+MODE_COUNTS = 2
+MODE_CLASSES = 3
+MODE_ANNOTATIONS = 4
+MODE_STATICS = 5
+MODE_SUBCLASSES = 6
+MODE_IMPLEMENTORS = 7
+MODE_ANCESTORS = 8
+MODE_DIFF = 9
+MODE_EXPORT = 10
+MODE_LINES = 11
+MODE_FINGERPRINTS = 12
+MODE_STRINGS = 13
+MODE_SYMBOLS = 14
 
 class filewrapper:
 	def __init__(self, f):
@@ -19,5 +38,139 @@ class filewrapper:
 		else:
 			self.pos = len(self.data) - pos
 
-def parse(filename, verbose = False):
-    return dexinfo(filewrapper(filename), verbose)
+# memory_limit caps what one parse may allocate, in bytes, 0 for no limit.
+# time_limit (milliseconds) and item_limit (classes, fields and methods)
+# end the parse early; the output then ends with a "[] Partial result" line
+def parse(filename, verbose = False, mode = MODE_FULL, class_filter = None, type_desc = None, memory_limit = 0,
+          time_limit = 0, item_limit = 0):
+    return dexinfo(filewrapper(filename), verbose, mode, class_filter, type_desc, None, memory_limit, None,
+                   time_limit, item_limit)
+
+def partial(output):
+    return "\n[] Partial result: " in output
+
+# debug information is decoded per method, limit it to the classes of interest
+def lines(filename, class_filter = None):
+    return parse(filename, False, MODE_LINES, class_filter)
+
+def fingerprints(filename, class_filter = None):
+    return parse(filename, False, MODE_FINGERPRINTS, class_filter)
+
+def static_values(filename, class_filter = None):
+    return parse(filename, False, MODE_STATICS, class_filter)
+
+def find_annotation(filename, annotation, class_filter = None):
+    return parse(filename, False, MODE_ANNOTATIONS, class_filter, annotation)
+
+# the hierarchy index is built once per call, pass every type of interest together
+def _types(types):
+    if isinstance(types, basestring):
+        return types
+    return ",".join(types)
+
+def subclasses(filename, types, class_filter = None):
+    return parse(filename, False, MODE_SUBCLASSES, class_filter, _types(types))
+
+def implementors(filename, types, class_filter = None):
+    return parse(filename, False, MODE_IMPLEMENTORS, class_filter, _types(types))
+
+def ancestors(filename, types):
+    return parse(filename, False, MODE_ANCESTORS, None, _types(types))
+
+# one pass over the string pool for all patterns, references lists the classes using each string
+def strings(filename, patterns, references = False, class_filter = None):
+    return parse(filename, references, MODE_STRINGS, class_filter, _types(patterns))
+
+# ids come from one table per python process, the same for every file parsed in it
+def symbols(filename, class_filter = None):
+    return parse(filename, False, MODE_SYMBOLS, class_filter)
+
+# other is read whole and handed over as a string
+def diff(filename, other, class_filter = None, memory_limit = 0, time_limit = 0, item_limit = 0):
+    return dexinfo(filewrapper(filename), False, MODE_DIFF, class_filter, None, other.read(), memory_limit, None,
+                   time_limit, item_limit)
+
+# writes the class, field and method tables to output, read them back with Columns;
+# nothing is written when a limit cuts the walk short, see partial()
+def export(filename, output, class_filter = None, memory_limit = 0, time_limit = 0, item_limit = 0):
+    return dexinfo(filewrapper(filename), False, MODE_EXPORT, class_filter, None, None, memory_limit, output,
+                   time_limit, item_limit)
+
+# reader of the files written by export() or dexinfo -E, layout in export.c
+class Columns:
+	FIXED = 0
+	DELTA = 1
+
+	def __init__(self, filename):
+		f = open(filename, "rb")
+		try:
+			self.data = mmap.mmap(f.fileno(), 0, access = mmap.ACCESS_READ)
+		finally:
+			f.close()
+
+		(magic, version, table_count, column_count, tables_off, columns_off,
+			self.dict_off) = struct.unpack_from("<8s6I", self.data, 0)
+		if magic != b"dexcol\n\0" or version != 1:
+			raise ValueError("%s is not a dexinfo column file" % filename)
+
+		self.tables = {}
+		for i in range(table_count):
+			name, rows, first, count, _ = struct.unpack_from("<16s4I", self.data, tables_off + i * 32)
+			self.tables[name.rstrip(b"\0").decode()] = (rows, first, count)
+
+		self.columns = []
+		for i in range(column_count):
+			self.columns.append(struct.unpack_from("<16s4BIQQ", self.data, columns_off + i * 40))
+
+		self.dict_count = struct.unpack_from("<I", self.data, self.dict_off)[0]
+		self.strings_off = self.dict_off + 4 * (self.dict_count + 2)
+		self.offsets = None
+
+	def close(self):
+		self.data.close()
+
+	def rows(self, table):
+		return self.tables[table][0]
+
+	def names(self, table):
+		rows, first, count = self.tables[table]
+		return [self.columns[i][0].rstrip(b"\0").decode() for i in range(first, first + count)]
+
+	def _column(self, table, name):
+		rows, first, count = self.tables[table]
+		for i in range(first, first + count):
+			if self.columns[i][0].rstrip(b"\0").decode() == name:
+				return self.columns[i]
+		raise KeyError(name)
+
+	# the raw values, dictionary ids for string columns
+	def ids(self, table, name):
+		name, encoding, width, strings, t, rows, off, size = self._column(table, name)
+		if encoding == self.FIXED:
+			return list(struct.unpack_from("<%d%s" % (rows, {1: "B", 2: "H", 4: "I"}[width]), self.data, off))
+
+		values = []
+		value = shift = delta = 0
+		for byte in bytearray(self.data[off:off + size]):
+			delta |= (byte & 0x7f) << shift
+			shift += 7
+			if byte & 0x80 == 0:
+				value += delta
+				values.append(value)
+				delta = shift = 0
+		return values
+
+	# dictionary string, id 0 is None
+	def string(self, i):
+		if i == 0:
+			return None
+		if self.offsets is None:
+			self.offsets = struct.unpack_from("<%dI" % (self.dict_count + 1), self.data, self.dict_off + 4)
+		return self.data[self.strings_off + self.offsets[i]:self.strings_off + self.offsets[i + 1] - 1]
+
+	# the values of a column, strings resolved
+	def column(self, table, name):
+		values = self.ids(table, name)
+		if self._column(table, name)[3]:
+			return [self.string(i) for i in values]
+		return values
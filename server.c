@@ -0,0 +1,345 @@
+/*
+ * dexinfo - a very rudimentary dex file parser
+ *
+ * Copyright (C) 2014 Keith Makan (@k3170Makan)
+ * Copyright (C) 2012-2013 Pau Oliva Fora (@pof)
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * dexinfo -L: a unix socket server for callers that would otherwise start
+ * one dexinfo per file. A request is a single line holding the arguments
+ * of the command line tool separated by tabs, the dex file first:
+ *
+ *	/data/app/base.dex\t-S\tLandroid/app/Activity;\n
+ *
+ * A client that has the file open instead sends "-" as the file and the
+ * descriptor along with the line (SCM_RIGHTS). The reply is what the
+ * command line tool would print, errors included, followed by an ERROR
+ * line with the exit status when that is not 0, and the connection is
+ * closed after it. Options that name other files (-D, -E) are refused, and
+ * a client has REQUEST_TIMEOUT to send its line.
+ *
+ * Requests are served by a pool of pre-forked workers accepting on the
+ * same socket. Each worker keeps its own image cache (cache.c) between
+ * requests and survives the requests that fail; one that dies anyway is
+ * replaced, and a fork that fails is retried with a growing delay.
+ */
+
+#ifndef PYDEXINFO
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "dexinfo.h"
+
+#define REQUEST_MAX	4096
+#define REQUEST_ARGS	64
+#define CACHE_ENTRIES	8
+#define REQUEST_TIMEOUT	5000	/* ms for the whole request line */
+#define FORK_BACKOFF	100	/* ms before retrying a failed fork, doubled up to FORK_BACKOFF_MAX */
+#define FORK_BACKOFF_MAX	10000
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop_handler(int sig)
+{
+	stopping = 1;
+}
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* read the request line, and the descriptor that came with it if any; -1 when it takes too long */
+static ssize_t read_request(int client, char *buf, size_t size, int *fd)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr hdr;
+		char data[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct pollfd pfd;
+	long long deadline = now_ms() + REQUEST_TIMEOUT, left;
+	size_t len = 0;
+	ssize_t n;
+
+	*fd = -1;
+
+	while (len < size - 1) {
+		/* a client sending nothing, or a byte at a time, must not hold the worker */
+		left = deadline - now_ms();
+		pfd.fd = client;
+		pfd.events = POLLIN;
+		n = left > 0 ? poll(&pfd, 1, (int)left) : 0;
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = buf + len;
+		iov.iov_len = size - 1 - len;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = &control;
+		msg.msg_controllen = sizeof(control);
+
+		n = recvmsg(client, &msg, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && *fd < 0)
+				memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+		}
+
+		len += n;
+		if (memchr(buf + len - n, '\n', n))
+			break;
+	}
+
+	buf[len] = '\0';
+	buf[strcspn(buf, "\r\n")] = '\0';
+
+	return len;
+}
+
+static void serve_request(int client)
+{
+	char buf[REQUEST_MAX];
+	char fdpath[32];
+	char *argv[REQUEST_ARGS + 1];
+	dexinfo_options opts;
+	int argc = 0, fd, c, out, err, ok = 1;
+	char *arg = buf;
+	int status = 1;
+
+	if (read_request(client, buf, sizeof(buf), &fd) <= 0) {
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+
+	argv[argc++] = "dexinfo";
+	while (arg && argc < REQUEST_ARGS) {
+		argv[argc++] = arg;
+		arg = strchr(arg, '\t');
+		if (arg)
+			*arg++ = '\0';
+	}
+	argv[argc] = NULL;
+
+	/* the output of the request goes to the client */
+	fflush(stdout);
+	fflush(stderr);
+	out = dup(STDOUT_FILENO);
+	err = dup(STDERR_FILENO);
+	dup2(client, STDOUT_FILENO);
+	dup2(client, STDERR_FILENO);
+
+	memset(&opts, 0, sizeof(opts));
+	opts.mode = DEXINFO_MODE_FULL;
+
+#ifdef __GLIBC__
+	optind = 0;		/* glibc resets its permutation state on 0 only */
+#else
+	optind = 1;
+	optreset = 1;
+#endif
+	while ((c = getopt(argc, argv, DEXINFO_REQUEST_OPTIONS)) != -1) {
+		if (dexinfo_option(c, optarg, &opts) < 0)
+			ok = 0;
+	}
+
+	/* getopt moved the file argument past the options */
+	if (!ok || optind >= argc) {
+		fprintf(stderr, "ERROR: invalid request\n");
+	} else if (strcmp(argv[optind], "-") == 0) {
+		if (fd < 0) {
+			fprintf(stderr, "ERROR: no file descriptor in request\n");
+		} else {
+			snprintf(fdpath, sizeof(fdpath), "/dev/fd/%d", fd);
+			dexinfo(fdpath, &opts);
+			status = dexinfo_status();
+		}
+	} else {
+		dexinfo(argv[optind], &opts);
+		status = dexinfo_status();
+	}
+	/* after the output, which stdout may still hold */
+	fflush(stdout);
+	if (status)
+		fprintf(stderr, "ERROR: request failed with status %d\n", status);
+
+	fflush(stdout);
+	fflush(stderr);
+	dup2(out, STDOUT_FILENO);
+	dup2(err, STDERR_FILENO);
+	close(out);
+	close(err);
+
+	if (fd >= 0)
+		close(fd);
+}
+
+static void worker(int sock)
+{
+	dex_cache cache;
+	int client;
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	/* also without a cache, dexinfo() must return to this loop on errors */
+	dexinfo_use_cache(dex_cache_init(&cache, CACHE_ENTRIES) == 0 ? &cache : NULL);
+
+	for (;;) {
+		client = accept(sock, NULL, NULL);
+		if (client < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			perror("accept");
+			exit(1);
+		}
+
+		serve_request(client);
+		close(client);
+	}
+}
+
+static pid_t spawn_worker(int sock)
+{
+	pid_t pid = fork();
+
+	if (pid == 0) {
+		worker(sock);
+		exit(0);
+	}
+	if (pid < 0)
+		perror("fork");
+
+	return pid;
+}
+
+int dexinfo_serve(const char *socket_path, int workers)
+{
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	pid_t *pids, pid;
+	int sock, i, missing, backoff = FORK_BACKOFF;
+
+	if (workers <= 0)
+		workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers <= 0)
+		workers = 1;
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "ERROR: socket path too long\n");
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	unlink(socket_path);
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, 128) < 0) {
+		perror(socket_path);
+		close(sock);
+		return -1;
+	}
+
+	pids = calloc(workers, sizeof(pid_t));
+	if (pids == NULL) {
+		fprintf(stderr, "ERROR: could not allocate memory!\n");
+		close(sock);
+		return -1;
+	}
+
+	/* a client going away mid reply must not take the worker with it */
+	signal(SIGPIPE, SIG_IGN);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop_handler;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	for (i = 0; i < workers; i++)
+		pids[i] = -1;
+
+	fprintf(stderr, "[] Listening on %s with %d workers\n", socket_path, workers);
+
+	/* start the workers, replace those that exit and retry the forks that failed */
+	while (!stopping) {
+		missing = 0;
+		for (i = 0; i < workers; i++) {
+			if (pids[i] < 0 && (pids[i] = spawn_worker(sock)) < 0)
+				missing = 1;
+		}
+
+		if (missing) {
+			poll(NULL, 0, backoff);
+			backoff = backoff * 2 > FORK_BACKOFF_MAX ? FORK_BACKOFF_MAX : backoff * 2;
+			pid = waitpid(-1, NULL, WNOHANG);
+		} else {
+			backoff = FORK_BACKOFF;
+			pid = wait(NULL);
+			if (pid < 0 && errno != EINTR)
+				break;
+		}
+
+		for (i = 0; pid > 0 && i < workers; i++) {
+			if (pids[i] == pid)
+				pids[i] = -1;
+		}
+	}
+
+	for (i = 0; i < workers; i++) {
+		if (pids[i] > 0)
+			kill(pids[i], SIGTERM);
+	}
+	while (wait(NULL) > 0 || errno == EINTR)
+		;
+
+	free(pids);
+	close(sock);
+	unlink(socket_path);
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,526 @@
+/*
+ * dexinfo - a very rudimentary dex file parser
+ *
+ * Copyright (C) 2014 Keith Makan (@k3170Makan)
+ * Copyright (C) 2012-2013 Pau Oliva Fora (@pof)
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * String pool scanner. dex_strings_scan() goes through string_ids in
+ * order, and since dx and d8 lay string_data_items out in that order too,
+ * through the string data section front to back, in place in the image.
+ *
+ * Most strings of a dex are ASCII, which MUTF-8 stores as is: when the
+ * utf16_size of a string_data_item is also its length in bytes and those
+ * bytes hold neither a high bit nor a NUL, 16 (SSE2) or 8 bytes at a time,
+ * the string is used from the image. Anything else is decoded and checked
+ * as MUTF-8 into UTF-8 in a scratch buffer: surrogate pairs become four
+ * byte sequences, other code points are re-encoded in their shortest form,
+ * except U+0000 which stays C0 80 so the result remains a C string.
+ *
+ * Every string runs once through an Aho-Corasick automaton built over the
+ * patterns. A pattern is a substring to look for, or when it has any of
+ * * ? [ \ an fnmatch(3) pattern matched against the whole string; the
+ * automaton then looks for the longest literal run of the pattern and
+ * fnmatch() only runs on the strings that contain it.
+ */
+
+#include <fnmatch.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "dexinfo.h"
+
+#define ROOT		0
+#define ALPHABET	256
+
+/* split patterns at commas and find what the automaton looks for in each */
+static u4 parse_patterns(dex_arena *arena, const char *patterns, dex_matcher *matcher, char **keys, u4 *key_lens)
+{
+	const char *p = patterns, *s;
+	char *pattern, *key, *cur;
+	u4 n = 0, len, run, best;
+
+	while (*p) {
+		len = strcspn(p, ",");
+		if (len == 0) {
+			p++;
+			continue;
+		}
+
+		/* the pattern, its key and the run being read */
+		pattern = dex_arena_alloc(arena, (size_t)len * 3 + 3);
+		if (pattern == NULL)
+			return NO_INDEX;
+		memcpy(pattern, p, len);
+		pattern[len] = '\0';
+		key = pattern + len + 1;
+		cur = key + len + 1;
+		p += len;
+		if (*p == ',')
+			p++;
+
+		matcher->patterns[n].same = NO_INDEX;
+		if (pattern[strcspn(pattern, "*?[\\")] == '\0') {
+			matcher->patterns[n].glob = NULL;
+			keys[n] = pattern;
+			key_lens[n] = len;
+			n++;
+			continue;
+		}
+
+		/* the longest run of characters the glob matches literally */
+		matcher->patterns[n].glob = pattern;
+		keys[n] = key;
+		key_lens[n] = 0;
+		run = best = 0;
+		for (s = pattern; *s; s++) {
+			if (*s == '*' || *s == '?' || *s == '[') {
+				if (*s == '[') {
+					/* a ] right after [ or [! belongs to the set */
+					s++;
+					if (*s == '!' || *s == '^')
+						s++;
+					if (*s == ']')
+						s++;
+					while (*s && *s != ']')
+						s++;
+					if (*s == '\0')
+						s--;
+				}
+				run = 0;
+				continue;
+			}
+			if (*s == '\\' && s[1])
+				s++;
+			cur[run++] = *s;
+			if (run > best) {
+				memcpy(key, cur, run);
+				best = run;
+			}
+		}
+		key_lens[n] = best;
+		n++;
+	}
+
+	return n;
+}
+
+/*
+ * Compile the comma separated patterns into matcher, in the arena of dex.
+ * Returns -1 when out of memory or when there is no pattern, 0 also when
+ * the budget of dex stopped the compilation, leaving matcher unusable.
+ */
+int dex_matcher_build(const dex_image *dex, const char *patterns, dex_matcher *matcher)
+{
+	dex_arena *arena = dex->arena;
+	char **keys;
+	u4 *key_lens, *fail, *queue, head = 0, tail = 0;
+	u4 n, i, j, max_states, state, r, s, c;
+
+	memset(matcher, 0, sizeof(*matcher));
+
+	/* at most one pattern per comma, and one more */
+	n = 1;
+	for (i = 0; patterns[i]; i++)
+		n += patterns[i] == ',';
+
+	matcher->patterns = dex_arena_alloc(arena, n * sizeof(dex_pattern));
+	keys = dex_arena_alloc(arena, n * sizeof(char *));
+	key_lens = dex_arena_alloc(arena, n * sizeof(u4));
+	matcher->tried = dex_arena_calloc(arena, n, sizeof(u4));
+	matcher->unkeyed = dex_arena_alloc(arena, n * sizeof(u4));
+	if (!matcher->patterns || !keys || !key_lens || !matcher->tried || !matcher->unkeyed)
+		return -1;
+
+	n = parse_patterns(arena, patterns, matcher, keys, key_lens);
+	if (n == NO_INDEX || n == 0)
+		return -1;
+	matcher->patterns_size = n;
+
+	max_states = 1;
+	for (i = 0; i < n; i++)
+		max_states += key_lens[i];
+
+	matcher->next = dex_arena_alloc(arena, (size_t)max_states * ALPHABET * sizeof(u4));
+	matcher->out = dex_arena_alloc(arena, (size_t)max_states * sizeof(u4));
+	matcher->dict = dex_arena_alloc(arena, (size_t)max_states * sizeof(u4));
+	fail = dex_arena_alloc(arena, (size_t)max_states * sizeof(u4));
+	queue = dex_arena_alloc(arena, (size_t)max_states * sizeof(u4));
+	if (!matcher->next || !matcher->out || !matcher->dict || !fail || !queue)
+		return -1;
+	memset(matcher->next, 0xff, (size_t)max_states * ALPHABET * sizeof(u4));	/* NO_INDEX */
+	memset(matcher->out, 0xff, (size_t)max_states * sizeof(u4));
+
+	/* the trie of the keys, patterns sharing a key chained on same */
+	matcher->states = 1;
+	for (i = n; i-- > 0; ) {
+		if (key_lens[i] == 0) {
+			matcher->unkeyed[matcher->unkeyed_size++] = i;
+			continue;
+		}
+		if (dex->budget && dex_budget_spend(dex, 0))
+			return 0;
+		state = ROOT;
+		for (j = 0; j < key_lens[i]; j++) {
+			c = (u1)keys[i][j];
+			if (matcher->next[state * ALPHABET + c] == NO_INDEX)
+				matcher->next[state * ALPHABET + c] = matcher->states++;
+			state = matcher->next[state * ALPHABET + c];
+		}
+		matcher->patterns[i].same = matcher->out[state];
+		matcher->out[state] = i;
+	}
+
+	/* failure links breadth first, missing transitions follow them */
+	matcher->dict[ROOT] = NO_INDEX;
+	for (c = 0; c < ALPHABET; c++) {
+		s = matcher->next[ROOT * ALPHABET + c];
+		if (s == NO_INDEX) {
+			matcher->next[ROOT * ALPHABET + c] = ROOT;
+		} else {
+			fail[s] = ROOT;
+			matcher->dict[s] = NO_INDEX;
+			queue[tail++] = s;
+		}
+	}
+	while (head < tail) {
+		if (dex->budget && dex_budget_spend(dex, 0))
+			return 0;
+		r = queue[head++];
+		for (c = 0; c < ALPHABET; c++) {
+			s = matcher->next[r * ALPHABET + c];
+			if (s == NO_INDEX) {
+				matcher->next[r * ALPHABET + c] = matcher->next[fail[r] * ALPHABET + c];
+				continue;
+			}
+			fail[s] = matcher->next[fail[r] * ALPHABET + c];
+			matcher->dict[s] = matcher->out[fail[s]] != NO_INDEX ? fail[s] : matcher->dict[fail[s]];
+			queue[tail++] = s;
+		}
+	}
+
+	return 0;
+}
+
+/* a glob is tried at most once per string, however often its key shows up */
+static int try_pattern(dex_matcher *matcher, u4 p, const char *str)
+{
+	const dex_pattern *pattern = &matcher->patterns[p];
+
+	if (pattern->glob == NULL)
+		return 1;
+	if (matcher->tried[p] == matcher->stamp)
+		return 0;
+
+	matcher->tried[p] = matcher->stamp;
+	return fnmatch(pattern->glob, str, 0) == 0;
+}
+
+/* lowest numbered pattern matching str, NO_INDEX for none */
+static u4 match(dex_matcher *matcher, const char *str, u4 len)
+{
+	const u1 *ptr = (const u1 *)str;
+	u4 state = ROOT, best = NO_INDEX, i, t, p;
+
+	matcher->stamp++;
+
+	for (i = 0; i < len && best != 0; i++) {
+		state = matcher->next[state * ALPHABET + ptr[i]];
+		t = matcher->out[state] != NO_INDEX ? state : matcher->dict[state];
+		for (; t != NO_INDEX; t = matcher->dict[t]) {
+			for (p = matcher->out[t]; p != NO_INDEX; p = matcher->patterns[p].same) {
+				if (p < best && try_pattern(matcher, p, str))
+					best = p;
+			}
+		}
+	}
+
+	for (i = 0; i < matcher->unkeyed_size; i++) {
+		p = matcher->unkeyed[i];
+		if (p < best && try_pattern(matcher, p, str))
+			best = p;
+	}
+
+	return best;
+}
+
+/* true when the n bytes at ptr are all ASCII and none is NUL */
+static int is_ascii(const u1 *ptr, u4 n)
+{
+	u4 i = 0;
+	u8 w;
+#ifdef __SSE2__
+	__m128i v, zero = _mm_setzero_si128();
+
+	for (; i + 16 <= n; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)(ptr + i));
+		if (_mm_movemask_epi8(_mm_or_si128(v, _mm_cmpeq_epi8(v, zero))))
+			return 0;
+	}
+#endif
+
+	/* high bits, and the high bits a byte of 0 leaves after the subtraction */
+	for (; i + 8 <= n; i += 8) {
+		memcpy(&w, ptr + i, 8);
+		if ((w | ((w - 0x0101010101010101ULL) & ~w)) & 0x8080808080808080ULL)
+			return 0;
+	}
+
+	for (; i < n; i++) {
+		if (ptr[i] == 0 || (ptr[i] & 0x80))
+			return 0;
+	}
+
+	return 1;
+}
+
+static u1 * put_utf8(u1 *out, u4 cp)
+{
+	if (cp < 0x80) {
+		*out++ = cp;
+	} else if (cp < 0x800) {
+		*out++ = 0xc0 | (cp >> 6);
+		*out++ = 0x80 | (cp & 0x3f);
+	} else if (cp < 0x10000) {
+		*out++ = 0xe0 | (cp >> 12);
+		*out++ = 0x80 | ((cp >> 6) & 0x3f);
+		*out++ = 0x80 | (cp & 0x3f);
+	} else {
+		*out++ = 0xf0 | (cp >> 18);
+		*out++ = 0x80 | ((cp >> 12) & 0x3f);
+		*out++ = 0x80 | ((cp >> 6) & 0x3f);
+		*out++ = 0x80 | (cp & 0x3f);
+	}
+
+	return out;
+}
+
+/* one MUTF-8 character at *ptr, -1 when it is not one */
+static s4 get_mutf8(const u1 **ptr, const u1 *end)
+{
+	const u1 *p = *ptr;
+	u4 cp;
+
+	if (p[0] < 0x80) {
+		*ptr = p + 1;
+		return p[0];
+	}
+	if ((p[0] & 0xe0) == 0xc0 && p + 1 < end && (p[1] & 0xc0) == 0x80) {
+		*ptr = p + 2;
+		return ((p[0] & 0x1f) << 6) | (p[1] & 0x3f);
+	}
+	if ((p[0] & 0xf0) == 0xe0 && p + 2 < end && (p[1] & 0xc0) == 0x80 && (p[2] & 0xc0) == 0x80) {
+		cp = ((p[0] & 0x0f) << 12) | ((p[1] & 0x3f) << 6) | (p[2] & 0x3f);
+		*ptr = p + 3;
+		return cp;
+	}
+
+	return -1;
+}
+
+/*
+ * Decode the string at ptr, NUL terminated before end, into out, which
+ * has room for three bytes per UTF-16 unit and the NUL. Bytes that are not
+ * MUTF-8 are copied as they are. Returns the length of the result and
+ * whether the input was well formed with utf16_size units.
+ */
+static u4 decode(const u1 *ptr, const u1 *end, u4 utf16_size, u1 *out, u4 out_size, int *valid)
+{
+	const u1 *next;
+	u1 *start = out, *limit = out + out_size - 4;
+	u4 units = 0;
+	s4 cp, low;
+
+	*valid = 1;
+	while (ptr < end && *ptr && out < limit) {
+		cp = get_mutf8(&ptr, end);
+		if (cp < 0) {
+			*valid = 0;
+			*out++ = *ptr++;
+			continue;
+		}
+
+		units++;
+		if (cp == 0) {
+			*out++ = 0xc0;
+			*out++ = 0x80;
+			continue;
+		}
+
+		/* a surrogate pair is one supplementary character */
+		if (cp >= 0xd800 && cp < 0xdc00 && ptr < end && *ptr) {
+			next = ptr;
+			low = get_mutf8(&next, end);
+			if (low >= 0xdc00 && low < 0xe000) {
+				ptr = next;
+				units++;
+				cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+			}
+		}
+		out = put_utf8(out, cp);
+	}
+
+	if (ptr >= end || *ptr || units != utf16_size)
+		*valid = 0;
+	*out = '\0';
+
+	return out - start;
+}
+
+/*
+ * Run every string of dex through matcher and hand the ones that match a
+ * pattern to cb. Returns -1 when out of memory, 0 also when the budget of
+ * dex stopped the scan. Strings count as items of the budget.
+ */
+int dex_strings_scan(const dex_image *dex, dex_matcher *matcher, dex_string_cb cb, void *ctx)
+{
+	dex_string_hit hit;
+	u1 *ptr, *end = dex->base + dex->size, *scratch = NULL;
+	u4 i, off, scratch_size = 0;
+	u8 need;
+	void *grown;
+
+	for (i = 0; i < *dex->header->string_ids_size; i++) {
+		if (dex->budget && dex_budget_spend(dex, 1))
+			return 0;
+
+		off = *dex->string_ids[i].string_data_off;
+		if (off >= dex->size)
+			continue;
+
+		ptr = dex->base + off;
+		hit.string_idx = i;
+		hit.utf16_size = dex_uleb128(dex, &ptr);
+
+		if (dex_in_image(dex, ptr - dex->base, (u8)hit.utf16_size + 1) && ptr[hit.utf16_size] == 0 &&
+		    is_ascii(ptr, hit.utf16_size)) {
+			hit.str = (const char *)ptr;
+			hit.len = hit.utf16_size;
+			hit.ascii = 1;
+			hit.valid = 1;
+		} else {
+			/* never more than the input, three bytes per unit when well formed */
+			need = (u8)hit.utf16_size * 3;
+			if (need > (u8)(end - ptr))
+				need = end - ptr;
+			need += 8;
+			if (need > scratch_size) {
+				grown = dex_arena_grow(dex->arena, scratch, scratch_size, need);
+				if (grown == NULL)
+					return -1;
+				scratch = grown;
+				scratch_size = need;
+			}
+			hit.len = decode(ptr, end, hit.utf16_size, scratch, need, &hit.valid);
+			hit.str = (const char *)scratch;
+			hit.ascii = 0;
+		}
+
+		hit.pattern = match(matcher, hit.str, hit.len);
+		if (hit.pattern != NO_INDEX)
+			cb(dex, &hit, ctx);
+	}
+
+	return 0;
+}
+
+typedef struct {
+	const u1 *wanted;
+	const char *class_filter;
+	u4 *last_class;		/* per string, last class reported with it */
+	u4 class_def_idx;
+	dex_string_ref_cb cb;
+	void *ctx;
+} refs_walk;
+
+static void add_ref(const dex_image *dex, refs_walk *walk, u4 string_idx)
+{
+	if (string_idx >= *dex->header->string_ids_size || !walk->wanted[string_idx] ||
+	    walk->last_class[string_idx] == walk->class_def_idx)
+		return;
+
+	walk->last_class[string_idx] = walk->class_def_idx;
+	walk->cb(dex, string_idx, walk->class_def_idx, walk->ctx);
+}
+
+static int refs_class(const dex_image *dex, const dex_class *cls, void *ctx)
+{
+	refs_walk *walk = ctx;
+	const char *desc;
+
+	if (walk->class_filter) {
+		desc = dex_type_desc(dex, *cls->class_def->class_idx);
+		if (desc == NULL || fnmatch(walk->class_filter, desc, 0) != 0)
+			return 1;
+	}
+
+	walk->class_def_idx = cls->class_def_idx;
+	return 0;
+}
+
+static void refs_field(const dex_image *dex, const dex_class *cls, const dex_field *field, void *ctx)
+{
+	if (field->value && field->value->type == VALUE_STRING)
+		add_ref(dex, ctx, field->value->v.idx);
+}
+
+static void refs_method(const dex_image *dex, const dex_class *cls, const dex_method *method, void *ctx)
+{
+	const code_item_struct *code;
+	dex_insn insn;
+	u4 pc = 0;
+
+	code = method->code_off ? dex_code_item(dex, method->code_off) : NULL;
+	if (code == NULL)
+		return;
+
+	while (pc < *code->insns_size && dex_insn_decode(code, pc, &insn) == 0) {
+		if (insn.index_kind == INDEX_STRING)
+			add_ref(dex, ctx, insn.index);
+		pc += insn.width;
+	}
+}
+
+static const dex_visitor refs_visitor = {
+	NULL, refs_class, NULL, refs_field, refs_method, .flags = DEX_VISIT_STATIC_VALUES
+};
+
+/*
+ * Call cb once for every class whose code (const-string) or static field
+ * values use a string flagged in wanted, indexed by string_idx, in class
+ * order. Classes whose descriptor does not match class_filter are skipped.
+ * Returns -1 when out of memory.
+ */
+int dex_string_refs(const dex_image *dex, const u1 *wanted, const char *class_filter, dex_string_ref_cb cb, void *ctx)
+{
+	refs_walk walk;
+	u4 size = *dex->header->string_ids_size;
+
+	walk.wanted = wanted;
+	walk.class_filter = class_filter;
+	walk.cb = cb;
+	walk.ctx = ctx;
+	walk.class_def_idx = NO_INDEX;
+	walk.last_class = dex_arena_alloc(dex->arena, (size ? size : 1) * sizeof(u4));
+	if (walk.last_class == NULL)
+		return -1;
+	memset(walk.last_class, 0xff, (size ? size : 1) * sizeof(u4));	/* NO_INDEX */
+
+	dex_visit(dex, &refs_visitor, &walk);
+	return 0;
+}
@@ -0,0 +1,326 @@
+/*
+ * dexinfo - a very rudimentary dex file parser
+ *
+ * Copyright (C) 2014 Keith Makan (@k3170Makan)
+ * Copyright (C) 2012-2013 Pau Oliva Fora (@pof)
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Symbol table shared by every parse of a process, by the workers of a
+ * server and, when it lives in a file, by every dexinfo run pointed at
+ * that file. It gives each distinct string one id, so the same class
+ * descriptor or method name has the same id in every dex of a corpus.
+ *
+ * The table is one shared mapping, all offsets, laid out as
+ *
+ *	dex_symbols_header
+ *	u8 slots[slots]		open addressing, 0 for empty, else the high
+ *				half of the hash above the id
+ *	u8 entries[max_ids]	1 + offset of the string of each id in bytes,
+ *				0 until the string is published
+ *	char bytes[bytes_size]	NUL terminated strings
+ *
+ * and nothing takes a lock after it is opened. A new string takes room
+ * for its bytes and an id with compare and swap loops, is copied, and is
+ * published by a compare and swap of an empty slot; whoever loses the race
+ * for that slot keeps probing and finds the winner's string if it was the
+ * same one, leaving its own id unused. Ids are never reused or moved, so a
+ * reader needs no more than an acquire load of the slot. The table does
+ * not grow: when it is full, interning returns 0.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dexinfo.h"
+
+#define SYMBOLS_SLOTS		(1u << 22)
+#define SYMBOLS_MAX_IDS		(1u << 21)
+#define SYMBOLS_BYTES		((u8)128 << 20)
+
+struct dex_symbols {
+	dex_symbols_header *header;
+	u8 *slots;
+	u8 *entries;
+	char *bytes;
+	size_t size;
+};
+
+static size_t table_size(u4 slots, u4 max_ids, u8 bytes_size)
+{
+	return sizeof(dex_symbols_header) + (size_t)slots * sizeof(u8) + (size_t)max_ids * sizeof(u8) + bytes_size;
+}
+
+/*
+ * Map the table in the file at path, creating it when it is missing or
+ * empty, or a table of this process and the children it forks when path
+ * is NULL. NULL on error, with errno set.
+ */
+dex_symbols * dex_symbols_open(const char *path)
+{
+	dex_symbols *symbols;
+	dex_symbols_header *header;
+	struct stat st;
+	void *base;
+	size_t size = table_size(SYMBOLS_SLOTS, SYMBOLS_MAX_IDS, SYMBOLS_BYTES);
+	int fd = -1;
+
+	if (path) {
+		fd = open(path, O_RDWR | O_CREAT, 0644);
+		if (fd < 0)
+			return NULL;
+
+		/* only creation is serialized, between processes opening the same file */
+		if (flock(fd, LOCK_EX) < 0 || fstat(fd, &st) < 0)
+			goto error;
+		if (st.st_size == 0) {
+			if (ftruncate(fd, size) < 0)
+				goto error;
+		} else {
+			if ((size_t)st.st_size < sizeof(dex_symbols_header)) {
+				errno = EINVAL;
+				goto error;
+			}
+			size = st.st_size;
+		}
+		base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	} else {
+		base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	}
+	if (base == MAP_FAILED)
+		goto error;
+
+	header = base;
+	if (header->magic[0] == 0) {
+		memcpy(header->magic, DEX_SYMBOLS_MAGIC, sizeof(header->magic));
+		header->version = DEX_SYMBOLS_VERSION;
+		header->slots = SYMBOLS_SLOTS;
+		header->max_ids = SYMBOLS_MAX_IDS;
+		header->bytes_size = SYMBOLS_BYTES;
+		header->next_id = 1;
+		header->bytes_used = 0;
+	}
+	if (memcmp(header->magic, DEX_SYMBOLS_MAGIC, sizeof(header->magic)) != 0 ||
+	    header->version != DEX_SYMBOLS_VERSION || (header->slots & (header->slots - 1)) != 0 ||
+	    table_size(header->slots, header->max_ids, header->bytes_size) > size) {
+		munmap(base, size);
+		errno = EINVAL;
+		goto error;
+	}
+
+	if (fd >= 0)
+		close(fd);
+
+	symbols = malloc(sizeof(*symbols));
+	if (symbols == NULL) {
+		munmap(base, size);
+		return NULL;
+	}
+	symbols->header = header;
+	symbols->slots = (u8 *)(header + 1);
+	symbols->entries = symbols->slots + header->slots;
+	symbols->bytes = (char *)(symbols->entries + header->max_ids);
+	symbols->size = size;
+	return symbols;
+
+error:
+	if (fd >= 0)
+		close(fd);
+	return NULL;
+}
+
+void dex_symbols_close(dex_symbols *symbols)
+{
+	munmap(symbols->header, symbols->size);
+	free(symbols);
+}
+
+/* number of ids handed out so far, unused ones included */
+u4 dex_symbols_count(const dex_symbols *symbols)
+{
+	u4 next = __atomic_load_n(&symbols->header->next_id, __ATOMIC_RELAXED);
+
+	return next > symbols->header->max_ids ? symbols->header->max_ids - 1 : next - 1;
+}
+
+/* the string of id, NULL for an id not handed out or whose string is still being copied */
+const char * dex_symbols_string(const dex_symbols *symbols, u4 id)
+{
+	u8 entry;
+
+	if (id == 0 || id >= symbols->header->max_ids ||
+	    id >= __atomic_load_n(&symbols->header->next_id, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	entry = __atomic_load_n(&symbols->entries[id], __ATOMIC_ACQUIRE);
+	return entry ? symbols->bytes + entry - 1 : NULL;
+}
+
+/*
+ * A new id holding a copy of str, 0 when the table is full. The bytes are
+ * reserved before the id and neither counter moves past its limit, so a
+ * full table hands out no id without a string behind it.
+ */
+static u4 new_symbol(dex_symbols *symbols, const char *str, size_t len)
+{
+	dex_symbols_header *header = symbols->header;
+	u4 id = __atomic_load_n(&header->next_id, __ATOMIC_RELAXED);
+	u8 off = __atomic_load_n(&header->bytes_used, __ATOMIC_RELAXED);
+
+	do {
+		if (off + len + 1 > header->bytes_size)
+			return 0;
+	} while (!__atomic_compare_exchange_n(&header->bytes_used, &off, off + len + 1, 1,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	do {
+		if (id >= header->max_ids)
+			return 0;
+	} while (!__atomic_compare_exchange_n(&header->next_id, &id, id + 1, 1,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	memcpy(symbols->bytes + off, str, len);
+	symbols->bytes[off + len] = '\0';
+	__atomic_store_n(&symbols->entries[id], off + 1, __ATOMIC_RELEASE);
+
+	return id;
+}
+
+/* id comes from a slot, which is only set once the entry of its id is */
+static int same_symbol(const dex_symbols *symbols, u4 id, const char *str, size_t len)
+{
+	const char *sym = symbols->bytes + __atomic_load_n(&symbols->entries[id], __ATOMIC_ACQUIRE) - 1;
+
+	return memcmp(sym, str, len) == 0 && sym[len] == '\0';
+}
+
+/* the id of the len bytes at str, new when nobody interned them yet, 0 when the table is full */
+u4 dex_symbols_intern(dex_symbols *symbols, const char *str, size_t len)
+{
+	u8 h = dex_hash(str, len, 0), *slot, v;
+	u4 mask = symbols->header->slots - 1, tag = h >> 32, i, probe, id = 0;
+
+	for (i = h & mask, probe = 0; probe <= mask; i = (i + 1) & mask, probe++) {
+		slot = &symbols->slots[i];
+		v = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+		if (v == 0) {
+			/* the copy is made once, whatever the number of slots tried */
+			if (id == 0 && (id = new_symbol(symbols, str, len)) == 0)
+				return 0;
+			if (__atomic_compare_exchange_n(slot, &v, ((u8)tag << 32) | id, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+				return id;
+			/* somebody else took the slot, v is what they put there */
+		}
+		if ((u4)(v >> 32) == tag && same_symbol(symbols, (u4)v, str, len))
+			return (u4)v;
+	}
+
+	return 0;
+}
+
+/* symbol ids of the strings of dex, looked up at most once per parse */
+int dex_symbol_map_init(const dex_image *dex, dex_symbols *symbols, dex_symbol_map *map)
+{
+	memset(map, 0, sizeof(*map));
+	map->dex = dex;
+	map->symbols = symbols;
+
+	map->strings = dex_arena_calloc(dex->arena, *dex->header->string_ids_size + 1, sizeof(u4));
+	map->protos = dex_arena_calloc(dex->arena, *dex->header->proto_ids_size + 1, sizeof(u4));
+	return map->strings && map->protos ? 0 : -1;
+}
+
+u4 dex_string_symbol(dex_symbol_map *map, u4 string_idx)
+{
+	const char *str;
+
+	if (string_idx >= *map->dex->header->string_ids_size)
+		return 0;
+
+	if (map->strings[string_idx] == 0) {
+		str = dex_string(map->dex, string_idx);
+		if (str)
+			map->strings[string_idx] = dex_symbols_intern(map->symbols, str, strlen(str));
+	}
+
+	return map->strings[string_idx];
+}
+
+u4 dex_type_symbol(dex_symbol_map *map, u4 type_idx)
+{
+	if (type_idx >= *map->dex->header->type_ids_size)
+		return 0;
+
+	return dex_string_symbol(map, *map->dex->type_ids[type_idx].descriptor_idx);
+}
+
+static int append(dex_symbol_map *map, u4 *len, const char *str)
+{
+	size_t n = strlen(str);
+	char *grown;
+	u4 alloc;
+
+	if (*len + n + 1 > map->scratch_alloc) {
+		alloc = map->scratch_alloc ? map->scratch_alloc : 256;
+		while (alloc < *len + n + 1)
+			alloc *= 2;
+		grown = dex_arena_grow(map->dex->arena, map->scratch, map->scratch_alloc, alloc);
+		if (grown == NULL)
+			return -1;
+		map->scratch = grown;
+		map->scratch_alloc = alloc;
+	}
+
+	memcpy(map->scratch + *len, str, n + 1);
+	*len += n;
+	return 0;
+}
+
+/* a prototype is interned as "(params)ret", (ILjava/lang/String;)V */
+u4 dex_proto_symbol(dex_symbol_map *map, u4 proto_idx)
+{
+	const dex_image *dex = map->dex;
+	const proto_id_struct *proto;
+	const u2 *params;
+	const char *desc;
+	u4 i, size = 0, len = 0;
+
+	if (proto_idx >= *dex->header->proto_ids_size)
+		return 0;
+	if (map->protos[proto_idx])
+		return map->protos[proto_idx];
+
+	proto = &dex->proto_ids[proto_idx];
+	params = dex_type_list(dex, *proto->parameters_off, &size);
+	if (append(map, &len, "(") < 0)
+		return 0;
+	for (i = 0; i < size; i++) {
+		desc = dex_type_desc(dex, params[i]);
+		if (append(map, &len, desc ? desc : "?") < 0)
+			return 0;
+	}
+	desc = dex_type_desc(dex, *proto->return_type_idx);
+	if (append(map, &len, ")") < 0 || append(map, &len, desc ? desc : "?") < 0)
+		return 0;
+
+	map->protos[proto_idx] = dex_symbols_intern(map->symbols, map->scratch, len);
+	return map->protos[proto_idx];
+}
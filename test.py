@@ -1,6 +1,17 @@
 #!/usr/bin/python
+# Run from the source tree once the tool and the module are built:
+#	make all && python test.py
+# The dex files are written here, by the small writer below.
 import pydexinfo
+import hashlib
+import os
 import re
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import zlib
 
 class t:
 	def read(self, size):
@@ -10,10 +21,469 @@ class t:
 	def seek(self, pos, whence = 0):
 		print "Seeking %d in %d" % (pos, whence)
 
+OBJECT = u"Ljava/lang/Object;"
+STRING = u"Ljava/lang/String;"
 
-#pydexinfo.dexinfo(t())
-f = open("classes.dex", "rb")
-s = pydexinfo.parse(f)
-f.close()
-print s
-# print(set(re.findall("MethodVal (.+)", s)))
+def uleb(n):
+	out = bytearray()
+	while True:
+		b = n & 0x7f
+		n >>= 7
+		if n == 0:
+			out.append(b)
+			return out
+		out.append(b | 0x80)
+
+def utf16(s):
+	b = s.encode("utf-16-le")
+	return struct.unpack("<%dH" % (len(b) // 2), b)
+
+# MUTF-8: NUL as C0 80, characters outside the BMP as two encoded surrogates
+def mutf8(s):
+	out = bytearray()
+	for u in utf16(s):
+		if u != 0 and u < 0x80:
+			out.append(u)
+		elif u < 0x800:
+			out += bytearray([0xc0 | (u >> 6), 0x80 | (u & 0x3f)])
+		else:
+			out += bytearray([0xe0 | (u >> 12), 0x80 | ((u >> 6) & 0x3f), 0x80 | (u & 0x3f)])
+	return out
+
+def shorty(desc):
+	return u"L" if desc[0] in u"L[" else desc
+
+def proto_of(ret, params):
+	return (shorty(ret) + u"".join(shorty(x) for x in params), ret, tuple(params))
+
+# classes: dicts with name, super, fields [(name, type)] and methods
+# [(name, return type, [parameter types], [strings loaded by const-string])],
+# annotations {method name: [annotation types]} and parameter_annotations
+# {method name: [[annotation types] per parameter]}; strings, types and
+# protos ((return type, [parameter types])) are added to the pools unused
+def make_dex(classes, strings = (), types = (), protos = ()):
+	unused = [proto_of(ret, params) for ret, params in protos]
+	strings, types, protos, fields, methods = set(strings), set(types), set(), set(), set()
+
+	def proto(ret, params):
+		p = proto_of(ret, params)
+		strings.add(p[0])
+		types.update([ret] + list(params))
+		protos.add(p)
+		return p
+
+	for p in unused:
+		strings.add(p[0])
+		types.update([p[1]] + list(p[2]))
+		protos.add(p)
+	for c in classes:
+		types.add(c["name"])
+		types.add(c.get("super", OBJECT))
+		for annotations in c.get("annotations", {}).values():
+			types.update(annotations)
+		for params in c.get("parameter_annotations", {}).values():
+			for annotations in params:
+				types.update(annotations)
+		for name, typ in c.get("fields", []):
+			strings.add(name)
+			types.add(typ)
+			fields.add((c["name"], typ, name))
+		for name, ret, params, loads in c.get("methods", []):
+			strings.add(name)
+			strings.update(loads)
+			methods.add((c["name"], proto(ret, params), name))
+	strings.update(types)
+
+	strings = sorted(strings, key = utf16)
+	sidx = dict((s, i) for i, s in enumerate(strings))
+	types = sorted(types, key = lambda x: sidx[x])
+	tidx = dict((x, i) for i, x in enumerate(types))
+	protos = sorted(protos, key = lambda p: (tidx[p[1]], [tidx[x] for x in p[2]]))
+	pidx = dict((p, i) for i, p in enumerate(protos))
+	fields = sorted(fields, key = lambda f: (tidx[f[0]], sidx[f[2]], tidx[f[1]]))
+	fidx = dict((f, i) for i, f in enumerate(fields))
+	methods = sorted(methods, key = lambda m: (tidx[m[0]], sidx[m[2]], pidx[m[1]]))
+	midx = dict((m, i) for i, m in enumerate(methods))
+
+	data_off = 0x70 + 4 * len(strings) + 4 * len(types) + 12 * len(protos) + \
+		8 * len(fields) + 8 * len(methods) + 32 * len(classes)
+	data = bytearray()
+
+	def here():
+		return data_off + len(data)
+
+	def align():
+		while here() % 4:
+			data.append(0)
+
+	# runtime annotations without elements, the set sorted by type
+	def annotation_set(annotations):
+		items = []
+		for typ in sorted(annotations, key = lambda x: tidx[x]):
+			items.append(here())
+			data.extend(bytearray([1]) + uleb(tidx[typ]) + uleb(0))
+		align()
+		off = here()
+		data.extend(struct.pack("<I", len(items)) + b"".join(struct.pack("<I", o) for o in items))
+		return off
+
+	string_offs = []
+	for s in strings:
+		string_offs.append(here())
+		data += uleb(len(utf16(s))) + mutf8(s) + bytearray(1)
+
+	param_offs = []
+	for p in protos:
+		align()
+		param_offs.append(here() if p[2] else 0)
+		if p[2]:
+			data += struct.pack("<I", len(p[2])) + b"".join(struct.pack("<H", tidx[x]) for x in p[2])
+
+	class_rows = []
+	for c in classes:
+		code_offs = {}
+		for name, ret, params, loads in c.get("methods", []):
+			m = (c["name"], proto_of(ret, params), name)
+			insns = b"".join(struct.pack("<HH", 0x1a, sidx[s]) for s in loads) + struct.pack("<H", 0x0e)
+			align()
+			code_offs[m] = here()
+			data += struct.pack("<HHHHII", 1, 0, 0, 0, 0, len(insns) // 2) + insns
+		own_fields = sorted(fidx[(c["name"], typ, name)] for name, typ in c.get("fields", []))
+		own_methods = sorted(code_offs, key = lambda m: midx[m])
+		data_item = 0
+		if own_fields or own_methods:
+			data_item = here()
+			data += uleb(0) + uleb(len(own_fields)) + uleb(0) + uleb(len(own_methods))
+			prev = 0
+			for i in own_fields:
+				data += uleb(i - prev) + uleb(2)
+				prev = i
+			prev = 0
+			for m in own_methods:
+				data += uleb(midx[m] - prev) + uleb(1) + uleb(code_offs[m])
+				prev = midx[m]
+		by_name = dict((m[2], midx[m]) for m in code_offs)
+		annotated = sorted((by_name[name], annotation_set(a)) for name, a in c.get("annotations", {}).items())
+		parameters = []
+		for name, params in c.get("parameter_annotations", {}).items():
+			sets = [annotation_set(a) if a else 0 for a in params]
+			align()
+			parameters.append((by_name[name], here()))
+			data += struct.pack("<I", len(sets)) + b"".join(struct.pack("<I", o) for o in sets)
+		annotations_off = 0
+		if annotated or parameters:
+			align()
+			annotations_off = here()
+			data += struct.pack("<4I", 0, 0, len(annotated), len(parameters))
+			data += b"".join(struct.pack("<II", *m) for m in annotated + sorted(parameters))
+		class_rows.append((tidx[c["name"]], 1, tidx[c.get("super", OBJECT)], 0, 0xffffffff, annotations_off,
+			data_item, 0))
+
+	align()
+	map_off = here()
+	offs = [0x70]
+	for size in (4 * len(strings), 4 * len(types), 12 * len(protos), 8 * len(fields), 8 * len(methods)):
+		offs.append(offs[-1] + size)
+	items = [(0, 1, 0), (1, len(strings), offs[0]), (2, len(types), offs[1]), (3, len(protos), offs[2]),
+		(4, len(fields), offs[3]), (5, len(methods), offs[4]), (6, len(classes), offs[5]),
+		(0x2002, len(strings), string_offs[0]), (0x1000, 1, map_off)]
+	data += struct.pack("<I", len(items)) + b"".join(struct.pack("<HHII", k, 0, n, o) for k, n, o in items)
+
+	out = bytearray(0x70)
+	out += b"".join(struct.pack("<I", o) for o in string_offs)
+	out += b"".join(struct.pack("<I", sidx[x]) for x in types)
+	out += b"".join(struct.pack("<III", sidx[p[0]], tidx[p[1]], param_offs[i]) for i, p in enumerate(protos))
+	out += b"".join(struct.pack("<HHI", tidx[f[0]], tidx[f[1]], sidx[f[2]]) for f in fields)
+	out += b"".join(struct.pack("<HHI", tidx[m[0]], pidx[m[1]], sidx[m[2]]) for m in methods)
+	out += b"".join(struct.pack("<8I", *r) for r in class_rows)
+	out += data
+	out[0:0x70] = struct.pack("<8sI20s20I", b"dex\n035\0", 0, b"\0" * 20, len(out), 0x70, 0x12345678, 0, 0, map_off,
+		len(strings), offs[0], len(types), offs[1], len(protos), offs[2], len(fields), offs[3],
+		len(methods), offs[4], len(classes), offs[5], len(data), data_off)
+	out[12:32] = hashlib.sha1(bytes(out[32:])).digest()
+	out[8:12] = struct.pack("<I", zlib.adler32(bytes(out[12:])) & 0xffffffff)
+	return bytes(out)
+
+def write_dex(directory, name, classes, **unused):
+	path = os.path.join(directory, name)
+	f = open(path, "wb")
+	f.write(make_dex(classes, **unused))
+	f.close()
+	return path
+
+TOOL = os.path.join(os.path.dirname(os.path.abspath(__file__)), "dexinfo")
+
+def parse(path, *args, **kwargs):
+	f = open(path, "rb")
+	try:
+		return pydexinfo.parse(f, *args, **kwargs)
+	finally:
+		f.close()
+
+# the last fields and methods are renamed, removed or changed between the two
+DIFF_OLD = [
+	dict(name = u"La/Kept;", fields = [(u"count", u"I")], methods = [(u"run", u"V", [], [u"same"])]),
+	dict(name = u"La/Changed;", fields = [(u"a\0", u"I"), (u"a\1", u"I")],
+		methods = [(u"run", u"V", [], [u"old"]), (u"gone", u"V", [STRING], [])]),
+	dict(name = u"La/Removed;", methods = [(u"run", u"V", [], [])]),
+	dict(name = u"La/\U0001f600;", methods = [(u"run", u"V", [], [])]),
+]
+DIFF_NEW = [
+	dict(name = u"La/Kept;", fields = [(u"count", u"I")], methods = [(u"run", u"V", [], [u"same"])]),
+	dict(name = u"La/Changed;", fields = [(u"a\1", u"I")],
+		methods = [(u"run", u"V", [], [u"new"]), (u"added", u"I", [], [])]),
+	dict(name = u"La/Added;", methods = [(u"run", u"V", [], [])]),
+	dict(name = u"La/\U0001f600;", methods = [(u"run", u"V", [], [])]),
+]
+
+JAVASCRIPT_INTERFACE = u"Landroid/webkit/JavascriptInterface;"
+
+BRIDGE = [
+	dict(name = u"Lw/Bridge;", methods = [(u"call", u"V", [STRING], []), (u"plain", u"V", [], []),
+		(u"post", u"V", [STRING, u"I"], [])],
+		annotations = {u"call": [JAVASCRIPT_INTERFACE, u"Lw/Other;"], u"plain": [u"Lw/Other;"]},
+		parameter_annotations = {u"post": [[u"Lw/Other;"], [JAVASCRIPT_INTERFACE]]}),
+	dict(name = u"Lw/Plain;", methods = [(u"run", u"V", [], [])], annotations = {u"run": [u"Lw/Other;"]}),
+]
+
+def annotation_hits(path):
+	f = open(path, "rb")
+	out = pydexinfo.find_annotation(f, JAVASCRIPT_INTERFACE.encode())
+	f.close()
+	hits = re.findall(r"^\[\] Class \d+ (.+)$", out, re.M)
+	total = re.search(r"\[\] Total: (\d+) annotations in (\d+) classes", out)
+	assert total and int(total.group(1)) == len(hits), out
+	return hits
+
+# set a u4 of a dex written by make_dex, whose checksums nothing verifies
+def patch_dex(directory, name, data, off, value):
+	data = bytearray(data)
+	data[off:off + 4] = struct.pack("<I", value)
+	path = os.path.join(directory, name)
+	f = open(path, "wb")
+	f.write(data)
+	f.close()
+	return path
+
+def test_annotations(directory):
+	dex = write_dex(directory, "bridge.dex", BRIDGE)
+	assert annotation_hits(dex) == [
+		"Lw/Bridge;: method call (runtime)",
+		"Lw/Bridge;: method post parameter 1 (runtime)",
+	]
+
+	# the directory of Lw/Bridge;: 16 bytes, then call and plain, then post
+	data = open(dex, "rb").read()
+	directory_off = struct.unpack_from("<I", data, struct.unpack_from("<I", data, 0x64)[0] + 20)[0]
+	call_set = directory_off + 16 + 4
+	post_list = directory_off + 16 + 2 * 8 + 4
+	post_list_off = struct.unpack_from("<I", data, post_list)[0]
+	for off, value, hits in (
+			(call_set, len(data) + 64, ["Lw/Bridge;: method post parameter 1 (runtime)"]),
+			(call_set, 0xfffffffc, ["Lw/Bridge;: method post parameter 1 (runtime)"]),
+			(post_list, len(data) - 2, ["Lw/Bridge;: method call (runtime)"]),
+			(post_list, 0xfffffffc, ["Lw/Bridge;: method call (runtime)"]),
+			(post_list_off, 0x3fffffff, ["Lw/Bridge;: method call (runtime)"]),
+			(post_list_off + 8, len(data) - 1, ["Lw/Bridge;: method call (runtime)"]),
+			(directory_off + 8, 0x10000000, [])):
+		assert annotation_hits(patch_dex(directory, "broken.dex", data, off, value)) == hits, (off, value)
+
+def test_diff(directory):
+	old = write_dex(directory, "old.dex", DIFF_OLD)
+	new = write_dex(directory, "new.dex", DIFF_NEW)
+	f, other = open(old, "rb"), open(new, "rb")
+	out = pydexinfo.diff(f, other)
+	f.close()
+	other.close()
+
+	report = out[out.index("[] Diff against"):].splitlines()[1:]
+	assert report == [
+		"[] Added class La/Added;",
+		"[] Changed class La/Changed; (fields, methods)",
+		"\tremoved field a\xc0\x80:I",
+		"\tadded method added()I",
+		"\tremoved method gone(Ljava/lang/String;)V",
+		"\tchanged method run()V (code)",
+		"[] Removed class La/Removed;",
+		"[] Total: 1 added, 1 removed, 1 changed classes",
+	], report
+
+	# a file against itself, non-BMP descriptor included, has no difference
+	f, other = open(new, "rb"), open(new, "rb")
+	out = pydexinfo.diff(f, other)
+	f.close()
+	other.close()
+	assert "[] Total: 0 added, 0 removed, 0 changed classes" in out, out
+
+def fingerprints(path):
+	f = open(path, "rb")
+	out = pydexinfo.fingerprints(f)
+	f.close()
+	return re.findall(r"^\[\] (Method|Class) ([0-9a-f]{16}) ", out, re.M)
+
+# fingerprints leave out names and the numbering of the pools
+def test_fingerprints(directory):
+	classes = DIFF_OLD + DIFF_NEW[1:3]
+	classes[4] = dict(classes[4], name = u"La/Changed2;")
+	original = write_dex(directory, "fp.dex", classes)
+	fp = fingerprints(original)
+	assert len(fp) == 14 and len(set(fp)) > 2, fp
+
+	# every pool renumbered by unused entries sorting first
+	renumbered = write_dex(directory, "renumbered.dex", classes, strings = [u"!"], types = [u"L!;", u"B"],
+		protos = [(u"B", [])])
+	assert fingerprints(renumbered) == fp
+
+	# app classes, members and strings renamed in the same order
+	def rename(s):
+		return s.replace(u"La/", u"Lz/").replace(u"run", u"r").replace(u"same", u"other")
+	renamed = [dict(c, name = rename(c["name"]), methods = [(rename(n), ret, params, [rename(x) for x in loads])
+		for n, ret, params, loads in c.get("methods", [])]) for c in classes]
+	assert fingerprints(write_dex(directory, "renamed.dex", renamed)) == fp
+
+	# nor do the diff hashes, which keep the names
+	f, other = open(original, "rb"), open(renumbered, "rb")
+	out = pydexinfo.diff(f, other)
+	f.close()
+	other.close()
+	assert "[] Total: 0 added, 0 removed, 0 changed classes" in out, out
+
+# the column file is read by Columns, whose record sizes must match export.c
+def test_export(directory):
+	dex = write_dex(directory, "export.dex", DIFF_OLD + DIFF_NEW[2:3])
+	output = os.path.join(directory, "export.col")
+	f = open(dex, "rb")
+	pydexinfo.export(f, output)
+	f.close()
+
+	assert struct.calcsize("<16s4I") == 32 and struct.calcsize("<16s4BIQQ") == 40
+	columns = pydexinfo.Columns(output)
+	size = os.path.getsize(output)
+	for column in columns.columns:
+		assert column[6] % 8 == 0 and column[6] + column[7] <= size, column
+
+	counts = re.search(r"\[\] Total: (\d+) classes, (\d+) fields, (\d+) methods", parse(dex, False, pydexinfo.MODE_COUNTS))
+	assert [columns.rows(t) for t in ("classes", "fields", "methods")] == [int(n) for n in counts.groups()]
+
+	names = re.findall(r"\[\] Class \d+ (.+)", parse(dex, False, pydexinfo.MODE_CLASSES))
+	assert columns.column("classes", "descriptor") == names, names
+	assert columns.column("classes", "superclass") == [OBJECT.encode()] * len(names)
+	assert columns.column("classes", "virtual_methods") == [1, 2, 1, 1, 1]
+
+	rows = zip(columns.column("methods", "class"), columns.column("methods", "name"),
+		columns.column("methods", "proto"), columns.column("methods", "code_size"))
+	assert (1, b"gone", b"(Ljava/lang/String;)V", 1) in rows, rows
+	assert (3, b"run", b"()V", 1) in rows, rows
+	assert (0, b"run", b"()V", 3) in rows, rows
+	fields = zip(columns.column("fields", "class"), columns.column("fields", "name"), columns.column("fields", "type"))
+	assert fields == [(0, b"count", b"I"), (1, b"a\xc0\x80", b"I"), (1, b"a\x01", b"I")], fields
+	columns.close()
+
+	# a walk cut short by a limit writes no file
+	os.remove(output)
+	f = open(dex, "rb")
+	out = pydexinfo.export(f, output, item_limit = 2)
+	f.close()
+	assert pydexinfo.partial(out) and not os.path.exists(output), out
+
+# the pool sorts by UTF-16 units, U+FFFD after the surrogates of U+1F600
+STRINGS = [
+	dict(name = u"Ls/Strings;", methods = [(u"run", u"V", [], [
+		u"xabcabcdx",
+		u"0123456789abcdef-past the first block needle",
+		u"0123456789abcdef-caf\u00e9 needle",
+		u"smile \U0001f600 needle",
+		u"nul\0needle",
+		u"\ufffdlast needle",
+	])]),
+]
+
+def matches(path, patterns):
+	f = open(path, "rb")
+	out = pydexinfo.strings(f, patterns)
+	f.close()
+	hits = [s.replace("\xc0\x80", "\0").decode("utf-8") for s in re.findall(r'\[\] String \d+ "(.*)"', out)]
+	total = re.search(r"\[\] Total: (\d+) matching strings of (\d+)", out)
+	assert total and int(total.group(1)) == len(hits), out
+	return hits
+
+def test_strings(directory):
+	dex = write_dex(directory, "strings.dex", STRINGS)
+
+	# overlapping keys, one inside another, all report the string once
+	assert matches(dex, ["abcab", "bcabcd", "cab", "xabc"]) == [u"xabcabcdx"]
+	assert matches(dex, "abcabcd,bca") == [u"xabcabcdx"]
+
+	# past the first 16 byte block, in ASCII and after a non-ASCII byte
+	assert matches(dex, "block needle") == [u"0123456789abcdef-past the first block needle"]
+	assert matches(dex, u"caf\u00e9".encode("utf-8")) == [u"0123456789abcdef-caf\u00e9 needle"]
+
+	# surrogate pairs come out as one four byte sequence, NUL as C0 80
+	assert matches(dex, u"\U0001f600".encode("utf-8")) == [u"smile \U0001f600 needle"]
+	assert matches(dex, "l\xc0\x80n") == [u"nul\0needle"]
+
+	# the last string of the pool, and globs against whole strings
+	assert matches(dex, u"\ufffdlast".encode("utf-8")) == [u"\ufffdlast needle"]
+	assert matches(dex, "*needle") == sorted((s for s in STRINGS[0]["methods"][0][3] if s.endswith(u"needle")), key = utf16)
+	assert matches(dex, "needle*") == []
+
+	for patterns in ([], "", ","):
+		f = open(dex, "rb")
+		try:
+			pydexinfo.strings(f, patterns)
+			assert False, patterns
+		except pydexinfo.Error:
+			pass
+		finally:
+			f.close()
+
+# processes racing on one table file agree on every id
+def test_symbols(directory):
+	dexes = [write_dex(directory, "old.dex", DIFF_OLD), write_dex(directory, "new.dex", DIFF_NEW)]
+	table = os.path.join(directory, "symbols.tab")
+	runs = [(dexes[i % 2], subprocess.Popen([TOOL, dexes[i % 2], "-i", "-G", table], stdout = subprocess.PIPE))
+		for i in range(8)]
+
+	lines, types = {}, {}
+	for dex, p in runs:
+		out = p.communicate()[0]
+		assert p.returncode == 0, out
+		ids = re.findall(r"^\[\] (?:Type|Field|Method) .*$", out, re.M)
+		assert lines.setdefault(dex, ids) == ids, (ids, lines[dex])
+		for id, desc in re.findall(r"^\[\] Type (\d+) (.+)$", out, re.M):
+			assert types.setdefault(desc, id) == id, (desc, id, types[desc])
+
+	assert len(set(types.values())) == len(types), types
+	assert OBJECT.encode() in types and "La/Kept;" in types and "La/Added;" in types
+
+# the -M cap fails a walk like any allocation, it is not a partial result
+def test_memory_limit(directory):
+	classes = [dict(name = u"Lm/C%d;" % i, methods = [(u"run", u"V", [], [u"s%d" % i])]) for i in range(200)]
+	dex = write_dex(directory, "memory.dex", classes)
+	for args, status in ((["-F"], 0), (["-F", "-M", "4k"], 1), (["-F", "-N", "10"], 3)):
+		p = subprocess.Popen([TOOL, dex] + args, stdout = subprocess.PIPE, stderr = subprocess.PIPE)
+		out, err = p.communicate()
+		assert p.returncode == status, (args, p.returncode, err)
+		assert ("memory limit of 4096 bytes exceeded" in err) == ("-M" in args), (args, err)
+		assert ("[] Partial result: " in out) == (status == 3), (args, out)
+
+def main():
+	directory = tempfile.mkdtemp()
+	try:
+		for name, test in sorted(globals().items()):
+			if name.startswith("test_"):
+				test(directory)
+				print "ok %s" % name
+	finally:
+		shutil.rmtree(directory)
+
+	if os.path.exists("classes.dex"):
+		#pydexinfo.dexinfo(t())
+		f = open("classes.dex", "rb")
+		s = pydexinfo.parse(f)
+		f.close()
+		print s
+		# print(set(re.findall("MethodVal (.+)", s)))
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,219 @@
+/*
+ * dexinfo - a very rudimentary dex file parser
+ *
+ * Copyright (C) 2014 Keith Makan (@k3170Makan)
+ * Copyright (C) 2012-2013 Pau Oliva Fora (@pof)
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * encoded_value decoding for static_values_off and annotation elements.
+ * Values are decoded from the image into a dex_value on the caller's
+ * stack; nested arrays and annotations are only skipped over until the
+ * caller asks to walk them.
+ */
+
+#include "dexinfo.h"
+
+/* nesting allowed while skipping over arrays and annotations */
+#define MAX_VALUE_DEPTH 32
+
+static int skip_values(const dex_image *dex, u1 **pptr, u4 n, int elements, int depth);
+
+/* little endian, 1 to 8 bytes */
+static u8 read_bytes(const u1 *ptr, int n)
+{
+	u8 result = 0;
+	int i;
+
+	for (i = n - 1; i >= 0; i--)
+		result = (result << 8) | ptr[i];
+
+	return result;
+}
+
+static int decode_value(const dex_image *dex, u1 **pptr, dex_value *value, int depth)
+{
+	u1 *ptr = *pptr;
+	u1 *end = dex->base + dex->size;
+	int arg, n;
+	u8 raw;
+	union {
+		u4 i;
+		float f;
+	} fbits;
+	union {
+		u8 i;
+		double d;
+	} dbits;
+
+	if (ptr >= end || depth > MAX_VALUE_DEPTH)
+		return -1;
+
+	value->type = *ptr & 0x1f;
+	arg = *ptr++ >> 5;
+	n = arg + 1;
+
+	switch (value->type) {
+	case VALUE_BYTE:
+	case VALUE_SHORT:
+	case VALUE_INT:
+	case VALUE_LONG:
+		if (n > 8 || ptr + n > end)
+			return -1;
+		/* sign extend from the top byte actually stored */
+		raw = read_bytes(ptr, n) << (64 - 8 * n);
+		value->v.s = (s8)raw >> (64 - 8 * n);
+		break;
+
+	case VALUE_CHAR:
+		if (n > 2 || ptr + n > end)
+			return -1;
+		value->v.s = read_bytes(ptr, n);
+		break;
+
+	case VALUE_FLOAT:
+		/* zero extended to the right, the stored bytes are the high order ones */
+		if (n > 4 || ptr + n > end)
+			return -1;
+		fbits.i = (u4)(read_bytes(ptr, n) << (8 * (4 - n)));
+		value->v.f = fbits.f;
+		break;
+
+	case VALUE_DOUBLE:
+		if (ptr + n > end)
+			return -1;
+		dbits.i = read_bytes(ptr, n) << (8 * (8 - n));
+		value->v.d = dbits.d;
+		break;
+
+	case VALUE_METHOD_TYPE:
+	case VALUE_METHOD_HANDLE:
+	case VALUE_STRING:
+	case VALUE_TYPE:
+	case VALUE_FIELD:
+	case VALUE_METHOD:
+	case VALUE_ENUM:
+		if (n > 4 || ptr + n > end)
+			return -1;
+		value->v.idx = (u4)read_bytes(ptr, n);
+		break;
+
+	case VALUE_ARRAY:
+		value->v.array.size = dex_uleb128(dex, &ptr);
+		value->v.array.values = ptr;
+		if (skip_values(dex, &ptr, value->v.array.size, 0, depth + 1) < 0)
+			return -1;
+		n = 0;
+		break;
+
+	case VALUE_ANNOTATION:
+		value->v.annotation.visibility = 0;
+		value->v.annotation.type_idx = dex_uleb128(dex, &ptr);
+		value->v.annotation.size = dex_uleb128(dex, &ptr);
+		value->v.annotation.elements = ptr;
+		if (skip_values(dex, &ptr, value->v.annotation.size, 1, depth + 1) < 0)
+			return -1;
+		n = 0;
+		break;
+
+	case VALUE_NULL:
+		n = 0;
+		break;
+
+	case VALUE_BOOLEAN:
+		value->v.z = arg;
+		n = 0;
+		break;
+
+	default:
+		return -1;
+	}
+
+	*pptr = ptr + n;
+	return 0;
+}
+
+static int skip_values(const dex_image *dex, u1 **pptr, u4 n, int elements, int depth)
+{
+	dex_value value;
+
+	while (n--) {
+		if (elements)
+			dex_uleb128(dex, pptr);
+		if (decode_value(dex, pptr, &value, depth) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* encoded_array_item at off, as found through static_values_off */
+int dex_encoded_array(const dex_image *dex, u4 off, dex_value_iter *it)
+{
+	memset(it, 0, sizeof(*it));
+	it->dex = dex;
+
+	if (off == 0 || !dex_in_image(dex, off, 1))
+		return -1;
+
+	it->ptr = dex->base + off;
+	it->remaining = dex_uleb128(dex, &it->ptr);
+
+	return 0;
+}
+
+void dex_array_values(const dex_image *dex, const dex_value *array, dex_value_iter *it)
+{
+	it->dex = dex;
+	it->ptr = array->v.array.values;
+	it->remaining = array->v.array.size;
+	it->elements = 0;
+}
+
+void dex_annotation_elements(const dex_image *dex, const dex_annotation *annotation, dex_value_iter *it)
+{
+	it->dex = dex;
+	it->ptr = annotation->elements;
+	it->remaining = annotation->size;
+	it->elements = 1;
+}
+
+/*
+ * Decode the next value. For annotation elements name_idx receives the
+ * element name, it may be NULL otherwise. Returns 1 for a value, 0 at the
+ * end and -1 on a malformed value, after which the walk is over.
+ */
+int dex_value_next(dex_value_iter *it, u4 *name_idx, dex_value *value)
+{
+	u4 name;
+
+	if (it->remaining == 0)
+		return 0;
+
+	if (it->elements) {
+		name = dex_uleb128(it->dex, &it->ptr);
+		if (name_idx)
+			*name_idx = name;
+	}
+
+	if (decode_value(it->dex, &it->ptr, value, 0) < 0) {
+		it->remaining = 0;
+		return -1;
+	}
+
+	it->remaining--;
+	return 1;
+}
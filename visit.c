@@ -0,0 +1,118 @@
+/*
+ * dexinfo - a very rudimentary dex file parser
+ *
+ * Copyright (C) 2014 Keith Makan (@k3170Makan)
+ * Copyright (C) 2012-2013 Pau Oliva Fora (@pof)
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * dex_visit(): decodes class_defs and class_data_items in place and hands
+ * every item to the callbacks of a dex_visitor. The walk itself lives in
+ * visit_classes.h and is compiled once per common set of callbacks.
+ */
+
+#include "dexinfo.h"
+
+/* what a visitor needs decoded */
+#define WANT_COUNTS	0x01
+#define WANT_FIELDS	0x02
+#define WANT_METHODS	0x04
+#define WANT_MEMBERS	0x08
+#define WANT_VALUES	0x10
+
+/* class_begin only: names, annotations */
+#define VISIT_NAME	visit_classes
+#define VISIT_WANT	0
+#include "visit_classes.h"
+#undef VISIT_NAME
+#undef VISIT_WANT
+
+/* counts only */
+#define VISIT_NAME	visit_counts
+#define VISIT_WANT	WANT_COUNTS
+#include "visit_classes.h"
+#undef VISIT_NAME
+#undef VISIT_WANT
+
+/* methods, the fields are only stepped over */
+#define VISIT_NAME	visit_methods
+#define VISIT_WANT	(WANT_COUNTS | WANT_METHODS)
+#include "visit_classes.h"
+#undef VISIT_NAME
+#undef VISIT_WANT
+
+/* fields and their initial values, the methods are not reached */
+#define VISIT_NAME	visit_fields
+#define VISIT_WANT	(WANT_COUNTS | WANT_MEMBERS | WANT_FIELDS | WANT_VALUES)
+#include "visit_classes.h"
+#undef VISIT_NAME
+#undef VISIT_WANT
+
+/* everything */
+#define VISIT_NAME	visit_all
+#define VISIT_WANT	(WANT_COUNTS | WANT_MEMBERS | WANT_FIELDS | WANT_METHODS | WANT_VALUES)
+#include "visit_classes.h"
+#undef VISIT_NAME
+#undef VISIT_WANT
+
+/* any other combination, tested at run time */
+#define VISIT_NAME	visit_generic
+#define VISIT_WANT	want
+#include "visit_classes.h"
+#undef VISIT_NAME
+#undef VISIT_WANT
+
+/*
+ * Walk the classes of dex with visitor. Returns what the header callback
+ * returned when it ended the walk early, 0 otherwise, also when the budget
+ * of dex stopped it: dex->budget->status tells the result is partial.
+ */
+int dex_visit(const dex_image *dex, const dex_visitor *visitor, void *ctx)
+{
+	int want = 0, ret;
+
+	if (visitor->header && (ret = visitor->header(dex, ctx)) != 0)
+		return ret;
+
+	if (visitor->flags & DEX_VISIT_COUNTS)
+		want |= WANT_COUNTS;
+	if (visitor->members)
+		want |= WANT_COUNTS | WANT_MEMBERS;
+	if (visitor->field)
+		want |= WANT_COUNTS | WANT_FIELDS;
+	if (visitor->field && (visitor->flags & DEX_VISIT_STATIC_VALUES))
+		want |= WANT_VALUES;
+	if (visitor->method)
+		want |= WANT_COUNTS | WANT_METHODS;
+
+	if (want == 0 && visitor->class_begin == NULL && visitor->class_end == NULL)
+		return 0;
+
+	switch (want) {
+	case 0:
+		return visit_classes(dex, visitor, ctx, want);
+	case WANT_COUNTS:
+		return visit_counts(dex, visitor, ctx, want);
+	case WANT_COUNTS | WANT_METHODS:
+		return visit_methods(dex, visitor, ctx, want);
+	case WANT_COUNTS | WANT_MEMBERS | WANT_FIELDS | WANT_VALUES:
+		return visit_fields(dex, visitor, ctx, want);
+	case WANT_COUNTS | WANT_MEMBERS | WANT_FIELDS | WANT_METHODS | WANT_VALUES:
+		return visit_all(dex, visitor, ctx, want);
+	}
+
+	return visit_generic(dex, visitor, ctx, want);
+}
@@ -0,0 +1,118 @@
+/*
+ * dexinfo - a very rudimentary dex file parser
+ *
+ * Copyright (C) 2014 Keith Makan (@k3170Makan)
+ * Copyright (C) 2012-2013 Pau Oliva Fora (@pof)
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The class walk of dex_visit(), included by visit.c once per
+ * specialization with VISIT_NAME and VISIT_WANT defined. VISIT_WANT is a
+ * literal in every copy but the generic one, so the tests on it fold away
+ * at any optimization level and each copy only decodes what its visitor
+ * has callbacks for.
+ */
+
+static int VISIT_NAME(const dex_image *dex, const dex_visitor *visitor, void *ctx, int want)
+{
+	const class_def_struct *class_def;
+	dex_class cls;
+	dex_field field;
+	dex_method method;
+	dex_value_iter values;
+	dex_value value;
+	u1 *ptr, *end = dex->base + dex->size;
+	u4 c, i, kind, idx, flags, code_off;
+
+	for (c = 0; c < *dex->header->class_defs_size; c++) {
+		if (dex->budget && dex_budget_spend(dex, 1))
+			return 0;
+
+		class_def = &dex->class_defs[c];
+		cls.class_def_idx = c;
+		cls.class_def = class_def;
+		memset(cls.counts, 0, sizeof(cls.counts));
+
+		/* a class_data_off outside the image reads as no class data */
+		ptr = NULL;
+		if ((VISIT_WANT & WANT_COUNTS) && *class_def->class_data_off &&
+		    dex_in_image(dex, *class_def->class_data_off, 1)) {
+			ptr = dex->base + *class_def->class_data_off;
+			for (kind = DEX_STATIC_FIELDS; kind <= DEX_VIRTUAL_METHODS; kind++)
+				cls.counts[kind] = dex_uleb128(dex, &ptr);
+		}
+
+		if (visitor->class_begin && visitor->class_begin(dex, &cls, ctx))
+			continue;
+
+		if (!(VISIT_WANT & (WANT_FIELDS | WANT_METHODS | WANT_MEMBERS)) || ptr == NULL)
+			goto class_end;
+
+		/* static field i is initialised by value i, when there is one */
+		if (VISIT_WANT & WANT_VALUES)
+			dex_encoded_array(dex, *class_def->static_values_off, &values);
+
+		for (kind = DEX_STATIC_FIELDS; kind <= DEX_VIRTUAL_METHODS; kind++) {
+			if ((VISIT_WANT & WANT_MEMBERS) && visitor->members(dex, &cls, kind, ctx))
+				break;
+
+			/* fields only, the methods need not be reached */
+			if (kind == DEX_DIRECT_METHODS && !(VISIT_WANT & (WANT_METHODS | WANT_MEMBERS)))
+				break;
+
+			idx = 0;
+			for (i = 0; i < cls.counts[kind] && ptr < end; i++) {
+				/* the class is left unfinished, without class_end */
+				if (dex->budget && dex_budget_spend(dex, 1))
+					return 0;
+
+				idx += dex_uleb128(dex, &ptr);
+				flags = dex_uleb128(dex, &ptr);
+
+				if (kind < DEX_DIRECT_METHODS) {
+					if (VISIT_WANT & WANT_FIELDS) {
+						field.kind = kind;
+						field.position = i;
+						field.field_idx = idx;
+						field.access_flags = flags;
+						field.value = NULL;
+						if ((VISIT_WANT & WANT_VALUES) && kind == DEX_STATIC_FIELDS &&
+						    dex_value_next(&values, NULL, &value) > 0)
+							field.value = &value;
+						visitor->field(dex, &cls, &field, ctx);
+					}
+					continue;
+				}
+
+				code_off = dex_uleb128(dex, &ptr);
+				if (VISIT_WANT & WANT_METHODS) {
+					method.kind = kind;
+					method.position = i;
+					method.method_idx = idx;
+					method.access_flags = flags;
+					method.code_off = code_off;
+					visitor->method(dex, &cls, &method, ctx);
+				}
+			}
+		}
+
+class_end:
+		if (visitor->class_end)
+			visitor->class_end(dex, &cls, ctx);
+	}
+
+	return 0;
+}